@@ -0,0 +1,267 @@
+// Benchmarks DSViz on large synthetic structures
+//
+//   bench [--max N] [--min N] [--filter substring]
+//
+// Every case runs in a child process, so the peak RSS reported is the peak of
+// that case alone. Allocations are counted from the start of load_ds to the
+// end of print.
+#include "dsv.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+static size_t allocations = 0;
+
+// noinline keeps gcc from pairing the inlined free with the new expression
+#if defined(__GNUC__)
+#define BENCH_NOINLINE __attribute__((noinline))
+#else
+#define BENCH_NOINLINE
+#endif
+
+BENCH_NOINLINE void *
+operator new(size_t size) {
+    ++allocations;
+    if (void *p = malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+BENCH_NOINLINE void
+operator delete(void *p) noexcept {
+    free(p);
+}
+BENCH_NOINLINE void
+operator delete(void *p, size_t) noexcept {
+    free(p);
+}
+
+enum Shape { List, Balanced, Degenerate, BTree, Dag, Array };
+
+static const char *shapeNames[] = {"list", "bst",  "bst-degenerate",
+                                   "btree", "dag", "array"};
+
+static Shape shape;
+
+// the same fields for both paths, only the way they are shown differs
+template <class Base> struct BenchNode : Base {
+    int                     data = 0;
+    std::vector<BenchNode*> kids;
+    std::vector<int>        arr;
+
+    virtual void dsviz_show(DSViz::IViz &viz);
+};
+
+struct Empty {
+    virtual ~Empty() {}
+    virtual void dsviz_show(DSViz::IViz &) {}
+};
+
+typedef BenchNode<DSViz::IDataStructure> Invasive;
+typedef BenchNode<Empty>                 Plain;
+
+void show(Plain *p, DSViz::IViz &viz);
+typedef DSViz::Mock<Plain, show> mock;
+
+static DSViz::IDataStructure *
+ref(Invasive *p) {
+    return p;
+}
+static DSViz::IDataStructure *
+ref(Plain *p) {
+    return mock::get(p);
+}
+
+template <class T>
+static void
+showNode(T *p, DSViz::IViz &viz) {
+    DSViz::TableNode node(viz, shape == Balanced || shape == Degenerate ? 2
+                                                                        : 1);
+    viz.setName(ref(p), node.name);
+    node.add("data", p->data);
+    if (!p->arr.empty()) node.addArray("keys", p->arr.data(), p->arr.size());
+    switch (shape) {
+    case Balanced:
+    case Degenerate:
+        node.addLeftRightSubTree("", ref(p->kids[0]), ref(p->kids[1]));
+        break;
+    case BTree: {
+        std::vector<DSViz::IDataStructure *> kids;
+        for (T *k : p->kids) kids.push_back(ref(k));
+        if (!kids.empty()) node.addChildren("", kids.data(), kids.size());
+        break;
+    }
+    default:
+        for (T *k : p->kids) node.addPointer("next", ref(k));
+    }
+}
+
+template <class Base>
+void
+BenchNode<Base>::dsviz_show(DSViz::IViz &viz) {
+    showNode(this, viz);
+}
+
+void
+show(Plain *p, DSViz::IViz &viz) {
+    showNode(p, viz);
+}
+
+template <class T>
+static T *
+build(size_t n, std::vector<T *> &all) {
+    all.resize(n);
+    for (size_t i = 0; i < n; ++i) {
+        all[i]       = new T();
+        all[i]->data = int(i);
+    }
+    switch (shape) {
+    case List:
+        for (size_t i = 0; i + 1 < n; ++i) all[i]->kids.push_back(all[i + 1]);
+        break;
+    case Balanced:
+        // heap order: the children of i are 2i+1 and 2i+2
+        for (size_t i = 0; i < n; ++i) {
+            all[i]->kids.push_back(2 * i + 1 < n ? all[2 * i + 1] : nullptr);
+            all[i]->kids.push_back(2 * i + 2 < n ? all[2 * i + 2] : nullptr);
+        }
+        break;
+    case Degenerate:
+        for (size_t i = 0; i < n; ++i) {
+            all[i]->kids.push_back(nullptr);
+            all[i]->kids.push_back(i + 1 < n ? all[i + 1] : nullptr);
+        }
+        break;
+    case BTree:
+        // 8 children and 7 keys per node
+        for (size_t i = 0; i < n; ++i) {
+            for (size_t k = 1; k <= 8 && 8 * i + k < n; ++k)
+                all[i]->kids.push_back(all[8 * i + k]);
+            for (int k = 0; k < 7; ++k) all[i]->arr.push_back(int(i) * 8 + k);
+        }
+        break;
+    case Dag:
+        // every node is shared by its two predecessors
+        for (size_t i = 0; i < n; ++i)
+            for (size_t k = 1; k <= 2 && i + k < n; ++k)
+                all[i]->kids.push_back(all[i + k]);
+        break;
+    case Array:
+        for (size_t i = 0; i < n; ++i) {
+            all[i]->arr.resize(256);
+            for (int k = 0; k < 256; ++k) all[i]->arr[k] = k;
+            if (i + 1 < n) all[i]->kids.push_back(all[i + 1]);
+        }
+        break;
+    }
+    return n ? all[0] : nullptr;
+}
+
+struct Result {
+    double load, print;
+    size_t bytes, allocs, rss;
+};
+
+static double
+since(std::chrono::steady_clock::time_point t) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - t)
+        .count();
+}
+
+template <class T>
+static Result
+run(size_t n) {
+    std::vector<T *> all;
+    T               *root = build(n, all);
+
+    Result           r;
+    DSViz::MockScope scope;
+    DSViz::Dot       dot;
+    allocations = 0;
+    auto t      = std::chrono::steady_clock::now();
+    dot.load_ds(ref(root));
+    r.load = since(t);
+    t      = std::chrono::steady_clock::now();
+    std::string out;
+    r.bytes  = dot.print(out).size;
+    r.print  = since(t);
+    r.allocs = allocations;
+
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+#ifdef __APPLE__
+    r.rss = ru.ru_maxrss;
+#else
+    r.rss = ru.ru_maxrss * 1024;
+#endif
+    return r;
+}
+
+// runs one case in a child so that the peak RSS is its own
+static bool
+fork_run(bool invasive, size_t n, Result &r) {
+    int fds[2];
+    if (pipe(fds) != 0) return false;
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        r = invasive ? run<Invasive>(n) : run<Plain>(n);
+        ssize_t w = write(fds[1], &r, sizeof r);
+        _exit(w == sizeof r ? 0 : 1);
+    }
+    close(fds[1]);
+    ssize_t got = pid > 0 ? read(fds[0], &r, sizeof r) : -1;
+    close(fds[0]);
+    int status = 0;
+    if (pid > 0) waitpid(pid, &status, 0);
+    return got == sizeof r && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+int
+main(int argc, char **argv) {
+    size_t      min = 1000, max = 1000000;
+    const char *filter = "";
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--max") == 0 && i + 1 < argc)
+            max = size_t(atof(argv[++i]));
+        else if (strcmp(argv[i], "--min") == 0 && i + 1 < argc)
+            min = size_t(atof(argv[++i]));
+        else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc)
+            filter = argv[++i];
+        else {
+            fprintf(stderr, "usage: %s [--max N] [--min N] [--filter name]\n",
+                    argv[0]);
+            return 2;
+        }
+    }
+
+    printf("%-16s %-8s %9s %10s %10s %12s %9s %12s\n", "shape", "path",
+           "nodes", "load_ms", "print_ms", "bytes", "rss_mb", "allocs/node");
+    for (int s = List; s <= Array; ++s) {
+        shape = Shape(s);
+        for (int invasive = 1; invasive >= 0; --invasive) {
+            std::string name = std::string(shapeNames[s]) + "/" +
+                               (invasive ? "invasive" : "mock");
+            if (!strstr(name.c_str(), filter)) continue;
+            for (size_t n = min; n <= max; n *= 10) {
+                Result r;
+                if (!fork_run(invasive, n, r)) {
+                    printf("%-16s %-8s %9zu  failed\n", shapeNames[s],
+                           invasive ? "invasive" : "mock", n);
+                    break;
+                }
+                printf("%-16s %-8s %9zu %10.1f %10.1f %12zu %9.1f %12.1f\n",
+                       shapeNames[s], invasive ? "invasive" : "mock", n,
+                       r.load * 1e3, r.print * 1e3, r.bytes, r.rss / 1048576.0,
+                       double(r.allocs) / n);
+                fflush(stdout);
+            }
+        }
+    }
+    return 0;
+}
@@ -23,17 +23,143 @@
 */
 
 #pragma once
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <future>
+#include <limits>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <new>
 #include <ostream>
+#include <set>
 #include <sstream>
+#include <streambuf>
 #include <string>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <typeindex>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
+// Define DSVIZ_STATS to 1 to collect the counters and timings of `Stats`
+#ifndef DSVIZ_STATS
+#define DSVIZ_STATS 0
+#endif
+
+#ifdef __GNUC__
+#include <cxxabi.h>
+#endif
+
+#if (defined(__x86_64__) || defined(__i386__)) &&                              \
+    (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define DSVIZ_HAS_X86_SIMD 1
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <cerrno>
+#include <unistd.h>
+#define DSVIZ_HAS_FD 1
+#endif
+
 namespace DSViz {
 
 class IViz;
-class Node;
+struct Cluster;
+class LayoutCache;
+
+/**
+ * @brief An open-addressing hash table from a pointer to a 32-bit id
+ * @details Linear probing over a power-of-two table which is kept at most
+ *          half full, so a lookup is usually a single probe. Null pointers
+ *          cannot be stored.
+ */
+class PtrIndex {
+  public:
+    enum : uint32_t { npos = 0xffffffffu };
+
+    PtrIndex() : slots(16), count(0) {}
+
+    /**
+     * @brief Find the id of a pointer
+     * @return The id or `npos` if the pointer is not in the table
+     */
+    uint32_t find(const void *key) const {
+        size_t mask = slots.size() - 1;
+        for (size_t i = hash(key) & mask;; i = (i + 1) & mask) {
+            if (slots[i].key == key) return slots[i].id;
+            if (slots[i].key == nullptr) return npos;
+        }
+    }
+
+    /**
+     * @brief Insert a pointer if it is not in the table yet
+     * @return The id already stored for the pointer, or `id` if it was added
+     */
+    uint32_t insert(const void *key, uint32_t id) {
+        assert(key != nullptr);
+        if ((count + 1) * 2 > slots.size()) grow();
+        size_t mask = slots.size() - 1;
+        size_t i    = hash(key) & mask;
+        for (; slots[i].key != nullptr; i = (i + 1) & mask) {
+            if (slots[i].key == key) return slots[i].id;
+        }
+        slots[i].key = key;
+        slots[i].id  = id;
+        ++count;
+        return id;
+    }
+
+    size_t size() const { return count; }
+
+    void clear() {
+        slots.assign(16, Slot());
+        count = 0;
+    }
+
+  private:
+    struct Slot {
+        const void *key = nullptr;
+        uint32_t    id  = 0;
+    };
+
+    static size_t hash(const void *key) {
+        uint64_t x = (uint64_t)(uintptr_t)key;
+        x ^= x >> 33;
+        x *= 0xff51afd7ed558ccdULL;
+        x ^= x >> 33;
+        return (size_t)x;
+    }
+
+    void grow() {
+        std::vector<Slot> old(slots.size() * 2);
+        old.swap(slots);
+        size_t mask = slots.size() - 1;
+        for (auto &s : old) {
+            if (s.key == nullptr) continue;
+            size_t i = hash(s.key) & mask;
+            while (slots[i].key != nullptr)
+                i = (i + 1) & mask;
+            slots[i] = s;
+        }
+    }
+
+    std::vector<Slot> slots;
+    size_t            count;
+};
 
 
 /**
@@ -44,37 +170,536 @@ class IDataStructure {
     virtual void dsviz_show(IViz &viz) = 0;
 };
 
+/**
+ * @brief A bump allocator which releases all of its memory at once
+ */
+class Arena {
+  public:
+    explicit Arena(size_t chunk_size = 4096) : chunk_size(chunk_size) {}
+    Arena(const Arena &)            = delete;
+    Arena &operator=(const Arena &) = delete;
+    ~Arena() { release(); }
+
+    void *allocate(size_t size, size_t align) {
+        uintptr_t p = (cur + align - 1) & ~(uintptr_t)(align - 1);
+        if (cur == 0 || p + size > end) {
+            size_t n = std::max(chunk_size, size + align);
+            // grow the chunks so that large scopes need few of them
+            if (chunk_size < (1u << 20)) chunk_size *= 2;
+            char *chunk = static_cast<char *>(::operator new(n));
+            chunks.push_back(chunk);
+            cur = (uintptr_t)chunk;
+            end = cur + n;
+            p   = (cur + align - 1) & ~(uintptr_t)(align - 1);
+        }
+        cur = p + size;
+        return (void *)p;
+    }
+
+    /**
+     * @brief Free every allocation made from this arena
+     */
+    void release() {
+        for (auto chunk : chunks)
+            ::operator delete(chunk);
+        chunks.clear();
+        cur = end = 0;
+    }
+
+  private:
+    size_t              chunk_size;
+    uintptr_t           cur = 0, end = 0;
+    std::vector<char *> chunks;
+};
+
+/**
+ * @brief The registry which `Mock::get` takes its mock objects from
+ * @details Creating a MockScope makes it the current registry of the thread
+ *          until it is destroyed; all mock objects created meanwhile come from
+ *          its arena and are released together with it. Outside of any scope,
+ *          mock objects are kept in a process-wide registry for the lifetime
+ *          of the program. A scope can be made current in other threads
+ *          through `Bind`, and while a `Share` of it lives `get` may be called
+ *          from all of them at once.
+ */
+class MockScope {
+  public:
+    MockScope() : parent(top()) { top() = this; }
+
+    /**
+     * @brief A scope which is only current where `Bind` makes it so
+     * @details For a scope kept across calls, such as by an object which
+     *          shows nodes on demand.
+     */
+    struct Unbound {};
+    explicit MockScope(Unbound) : parent(nullptr) {}
+
+    MockScope(const MockScope &)            = delete;
+    MockScope &operator=(const MockScope &) = delete;
+    ~MockScope() {
+        if (top() == this) top() = parent;
+    }
+
+    /**
+     * @brief The innermost scope of this thread, or the process-wide one
+     */
+    static MockScope &current() {
+        MockScope *s = top();
+        return s ? *s : global();
+    }
+
+    /**
+     * @brief Makes a scope the current one of this thread while it lives
+     */
+    class Bind {
+      public:
+        explicit Bind(MockScope &scope) : saved(top()) { top() = &scope; }
+        Bind(const Bind &)            = delete;
+        Bind &operator=(const Bind &) = delete;
+        ~Bind() { top() = saved; }
+
+      private:
+        MockScope *saved;
+    };
+
+    /**
+     * @brief Lets several threads call `get` of a scope while it lives
+     * @details Create it before the threads start using the scope and keep it
+     *          until they are done. Without one, `get` takes no lock; the
+     *          process-wide scope is always shared.
+     */
+    class Share {
+      public:
+        explicit Share(MockScope &scope) : scope(scope) { ++scope.shared; }
+        Share(const Share &)            = delete;
+        Share &operator=(const Share &) = delete;
+        ~Share() { --scope.shared; }
+
+      private:
+        MockScope &scope;
+    };
+
+    /**
+     * @brief Get the mock object of type M for a pointer, creating it if needed
+     */
+    template <class M, class T> M *get(T *ds) {
+        if (ds == nullptr) return nullptr;
+        std::unique_lock<std::mutex> lock(mutex, std::defer_lock);
+        if (shared.load(std::memory_order_relaxed) != 0) lock.lock();
+        size_t t = typeIndex<M>();
+        if (t >= indexes.size()) indexes.resize(t + 1);
+        uint32_t id = indexes[t].insert(ds, (uint32_t)mocks.size());
+        if (id == mocks.size())
+            mocks.push_back(new (arena.allocate(sizeof(M), alignof(M))) M(ds));
+        return static_cast<M *>(mocks[id]);
+    }
+
+    /**
+     * @brief Number of mock objects created in this scope
+     */
+    size_t size() const { return mocks.size(); }
+
+  private:
+    static MockScope *&top() {
+        static thread_local MockScope *inst = nullptr;
+        return inst;
+    }
+
+    static MockScope &global() {
+        static MockScope inst{Unbound()};
+        // any thread outside of a scope may use it
+        static Share always(inst);
+        return inst;
+    }
+
+    template <class M> static size_t typeIndex() {
+        static const size_t id = nextTypeIndex()++;
+        return id;
+    }
+
+    static std::atomic<size_t> &nextTypeIndex() {
+        static std::atomic<size_t> inst(0);
+        return inst;
+    }
+
+    MockScope            *parent;
+    std::atomic<unsigned> shared{0}; // see Share
+    std::mutex            mutex;
+    Arena                 arena;
+    std::vector<PtrIndex> indexes; // one per mock type
+    std::vector<void *>   mocks;
+};
+
+/**
+ * @brief The part of every `Mock` which does not depend on the mocked type
+ */
+class MockBase : public IDataStructure {
+  public:
+    /**
+     * @brief The original pointer the mock object stands for
+     */
+    void *target() const { return ptr; }
+
+  protected:
+    explicit MockBase(void *ptr) : ptr(ptr) {}
+    void *ptr;
+};
+
 /**
  * @brief A mock class which provides a non-invasive way to print graphviz dot
  * @param T The type of data structure you want to mock
  * @param F The function to print the data structure
  */
 template <typename T, void (*F)(T*, IViz &)>
-class Mock : public IDataStructure {
+class Mock : public MockBase {
   public:
-    virtual void dsviz_show(IViz &viz) override {
-        F(ds, viz);
-    }
+    virtual void dsviz_show(IViz &viz) override;
 
     /**
      * @brief Get the mock object pointer from the original pointer
+     * @details The mock object belongs to the current `MockScope`.
      * @param ds The original pointer
+     * @return The mock object, or nullptr if `ds` is nullptr
      */
     static Mock<T,F>* get(T *ds) {
-        auto& c = container();
-        if (c.find(ds) == c.end()) {
-            c[ds] = new Mock(ds);
+        return MockScope::current().template get<Mock<T, F>>(ds);
+    }
+  private:
+    friend class MockScope;
+
+    Mock(T *ds) : MockBase(ds) {}
+};
+
+/**
+ * @brief Escapes text for the HTML-like labels of graphviz
+ * @details `<` and `>` become `&lt;` and `&gt;`, and the characters
+ *          `=?:&^~*%/();[]{}` become numeric references such as `&#61;`.
+ *          So does 0x1F, which `ParallelWalker` marks its placeholders with.
+ *          Clean runs are found 16 or 32 bytes at a time with SSE2 or AVX2,
+ *          chosen when first used, and copied in bulk.
+ */
+class HtmlEncoder {
+  public:
+    /**
+     * @brief Append the escaped form of `data` to `out`
+     */
+    static void append(std::string &out, const char *data, size_t size) {
+        // most text needs no escaping, grow once for the common case
+        if (out.capacity() < out.size() + size)
+            out.reserve(std::max(out.size() + size, out.capacity() * 2));
+        ScanFn scan = scanner();
+        size_t i    = 0;
+        while (i < size) {
+            size_t j = scan(data, i, size);
+            out.append(data + i, j - i);
+            if (j == size) break;
+            escape(out, data[j]);
+            i = j + 1;
         }
-        return c[ds]; 
     }
+
+    static bool isSpecial(char c) { return table()[(unsigned char)c]; }
+
   private:
-    static std::map<T*, Mock<T,F>*>& container() {
-        static std::map<T*, Mock<T,F>*> inst;
+    // returns the position of the first special character at or after i
+    typedef size_t (*ScanFn)(const char *, size_t, size_t);
+
+    static void escape(std::string &out, char c) {
+        if (c == '<') {
+            out += "&lt;";
+        } else if (c == '>') {
+            out += "&gt;";
+        } else {
+            char buf[8] = {'&', '#'};
+            int  n      = 2;
+            if (c >= 100) buf[n++] = '0' + c / 100;
+            buf[n++] = '0' + c / 10 % 10;
+            buf[n++] = '0' + c % 10;
+            buf[n++] = ';';
+            out.append(buf, n);
+        }
+    }
+
+    static const bool *table() {
+        static const struct Table {
+            bool v[256];
+            Table() : v() {
+                for (auto c : std::string("<>=?:&^~*%/();[]{}\x1f"))
+                    v[(unsigned char)c] = true;
+            }
+        } inst;
+        return inst.v;
+    }
+
+    static size_t scanScalar(const char *data, size_t i, size_t size) {
+        const bool *t = table();
+        while (i < size && !t[(unsigned char)data[i]])
+            ++i;
+        return i;
+    }
+
+#ifdef DSVIZ_HAS_X86_SIMD
+    // bytes in [lo, lo + n) compare equal to 0xff
+    __attribute__((target("sse2"))) static __m128i
+    inRange(__m128i v, char lo, char n) {
+        __m128i x = _mm_sub_epi8(v, _mm_set1_epi8(lo));
+        return _mm_cmpeq_epi8(_mm_min_epu8(x, _mm_set1_epi8(n - 1)), x);
+    }
+
+    __attribute__((target("sse2"))) static size_t
+    scanSSE2(const char *data, size_t i, size_t size) {
+        for (; i + 16 <= size; i += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(data + i));
+            __m128i m = _mm_or_si128(inRange(v, 0x25, 2), inRange(v, 0x28, 3));
+            m = _mm_or_si128(m, inRange(v, 0x3a, 6));
+            m = _mm_or_si128(m, inRange(v, 0x5d, 2));
+            m = _mm_or_si128(m, inRange(v, 0x7d, 2));
+            m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('/')));
+            m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('[')));
+            m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('{')));
+            m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('\x1f')));
+            int bits = _mm_movemask_epi8(m);
+            if (bits) return i + __builtin_ctz(bits);
+        }
+        return scanScalar(data, i, size);
+    }
+
+    // Each special character is found by a nibble lookup: the table of the
+    // low nibble holds one bit per high nibble (2, 3, 5, 7, 1) it is special
+    // in.
+    __attribute__((target("avx2"))) static size_t
+    scanAVX2(const char *data, size_t i, size_t size) {
+        const __m256i lo_table = _mm256_setr_epi8(
+            0, 0, 0, 0, 0, 1, 1, 0, 1, 1, 3, 14, 2, 14, 14, 19, //
+            0, 0, 0, 0, 0, 1, 1, 0, 1, 1, 3, 14, 2, 14, 14, 19);
+        const __m256i hi_table = _mm256_setr_epi8(
+            0, 16, 1, 2, 0, 4, 0, 8, 0, 0, 0, 0, 0, 0, 0, 0, //
+            0, 16, 1, 2, 0, 4, 0, 8, 0, 0, 0, 0, 0, 0, 0, 0);
+        const __m256i nibble = _mm256_set1_epi8(0x0f);
+        for (; i + 32 <= size; i += 32) {
+            __m256i v  = _mm256_loadu_si256((const __m256i *)(data + i));
+            __m256i lo =
+                _mm256_shuffle_epi8(lo_table, _mm256_and_si256(v, nibble));
+            __m256i hi = _mm256_shuffle_epi8(
+                hi_table, _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble));
+            __m256i m = _mm256_cmpeq_epi8(_mm256_and_si256(lo, hi),
+                                          _mm256_setzero_si256());
+            unsigned bits = ~(unsigned)_mm256_movemask_epi8(m);
+            if (bits) return i + __builtin_ctz(bits);
+        }
+        return scanSSE2(data, i, size);
+    }
+#endif
+
+    static ScanFn scanner() {
+        static const ScanFn inst = pickScanner();
         return inst;
     }
 
-    Mock(T *ds) : ds(ds) {}
-    T *ds;
+    static ScanFn pickScanner() {
+#ifdef DSVIZ_HAS_X86_SIMD
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) return &scanAVX2;
+        if (__builtin_cpu_supports("sse2")) return &scanSSE2;
+#endif
+        return &scanScalar;
+    }
+};
+
+/**
+ * @brief A string which is not owned, like std::string_view
+ * @details Taken by the builder functions which only read their strings, so
+ *          a literal or a std::string is passed without a copy. The string
+ *          must outlive the call.
+ */
+class StrRef {
+  public:
+    StrRef() : p(""), n(0) {}
+    StrRef(const char *s) : p(s), n(strlen(s)) {}
+    StrRef(const char *s, size_t n) : p(s), n(n) {}
+    StrRef(const std::string &s) : p(s.data()), n(s.size()) {}
+
+    const char *data() const { return p; }
+    size_t      size() const { return n; }
+    bool        empty() const { return n == 0; }
+    char        operator[](size_t i) const { return p[i]; }
+    std::string str() const { return std::string(p, n); }
+
+    friend std::string &operator+=(std::string &out, StrRef s) {
+        return out.append(s.p, s.n);
+    }
+
+  private:
+    const char *p;
+    size_t      n;
+};
+
+/**
+ * @brief A field value handed to a `Recorder` without formatting it
+ */
+struct Value {
+    enum Kind : uint8_t { String, Int, UInt, Double, Bool };
+
+    Kind kind;
+    union {
+        int64_t  i;
+        uint64_t u;
+        double   d;
+        bool     b;
+    };
+    StrRef s; // only valid during the call
+
+    static Value of(StrRef v) {
+        Value x(String);
+        x.s = v;
+        return x;
+    }
+    static Value of(bool v) {
+        Value x(Bool);
+        x.b = v;
+        return x;
+    }
+    template <class T>
+    static typename std::enable_if<std::is_integral<T>::value &&
+                                       std::is_signed<T>::value,
+                                   Value>::type
+    of(T v) {
+        Value x(Int);
+        x.i = v;
+        return x;
+    }
+    template <class T>
+    static typename std::enable_if<std::is_integral<T>::value &&
+                                       !std::is_signed<T>::value,
+                                   Value>::type
+    of(T v) {
+        Value x(UInt);
+        x.u = v;
+        return x;
+    }
+    template <class T>
+    static typename std::enable_if<std::is_same<T, float>::value ||
+                                       std::is_same<T, double>::value,
+                                   Value>::type
+    of(T v) {
+        Value x(Double);
+        x.d = v;
+        return x;
+    }
+
+    /**
+     * @brief True if T is stored without formatting, other types are
+     *        formatted with std::to_string first
+     */
+    template <class T> struct IsRaw {
+        static const bool value = std::is_integral<T>::value ||
+                                  std::is_same<T, float>::value ||
+                                  std::is_same<T, double>::value;
+    };
+
+    /**
+     * @brief Format the value the same way `TableNode::add` does
+     */
+    std::string format() const {
+        switch (kind) {
+        case String: return s.str();
+        case Int: return std::to_string((long long)i);
+        case UInt: return std::to_string((unsigned long long)u);
+        case Double: return std::to_string(d);
+        case Bool: return b ? "true" : "false";
+        }
+        return std::string();
+    }
+
+  private:
+    explicit Value(Kind kind) : kind(kind), u(0) {}
+};
+
+/**
+ * @brief Receives the rows of table nodes before they are formatted
+ * @details A graph returning a recorder from `IViz::recorder` gets the fields
+ *          of every `TableNode` built on it through these calls, and no HTML
+ *          label is made. Several table nodes may be open at the same time,
+ *          so each call names the node it belongs to.
+ */
+class Recorder {
+  public:
+    /**
+     * @brief Start a table node
+     * @return A handle passed to the other calls for this node
+     */
+    virtual uint32_t beginNode(const std::string &name, int span)     = 0;
+    virtual void     beginRow(uint32_t node)                         = 0;
+    virtual void     endRow(uint32_t node)                           = 0;
+    virtual void     cellName(uint32_t node, StrRef name, StrRef attr) = 0;
+
+    /**
+     * @param spanned True if the cell spans the columns of the node
+     */
+    virtual void cellValue(uint32_t node, const Value &value, StrRef attr,
+                           StrRef port, bool spanned) = 0;
+
+    virtual void endNode(uint32_t node, const std::string &shape,
+                         const std::string                        &style,
+                         const std::map<std::string, std::string> &attrs) = 0;
+};
+
+/**
+ * @brief A recorder which drops every row, so table nodes format nothing
+ */
+struct NullRecorder : Recorder {
+    uint32_t beginNode(const std::string &, int) override { return 0; }
+    void     beginRow(uint32_t) override {}
+    void     endRow(uint32_t) override {}
+    void     cellName(uint32_t, StrRef, StrRef) override {}
+    void     cellValue(uint32_t, const Value &, StrRef, StrRef,
+                       bool) override {}
+    void     endNode(uint32_t, const std::string &, const std::string &,
+                     const std::map<std::string, std::string> &) override {}
+};
+
+/**
+ * @brief The order in which `load_ds` expands the nodes it reaches
+ */
+enum class Order { DFS, BFS };
+
+/**
+ * @brief How long rows and chains are shortened
+ * @details A row of `addArray`, `addChildren` or `addChildrenC` with more
+ *          than 2 * `row_ends` + 1 cells keeps `row_ends` cells at each end,
+ *          and the cells between them are replaced by one `… N elided …`
+ *          cell; they are not formatted, and children in them are not
+ *          loaded. With `run_length`, equal neighbours in an array are shown
+ *          as one `value ×N` cell, and `row_ends` counts those cells.
+ *          `load_ds` also shortens chains, paths of nodes which each load
+ *          one node that is not shown yet. After `chain_ends` (at least 1)
+ *          nodes of a chain, the rest of it is one `… N more` node. The
+ *          rest is still walked to count it, but into a graph that keeps
+ *          nothing, so no labels are built. A node which loads several
+ *          nodes ends the chain and is shown. Walkers with a loop of their
+ *          own, such as `ParallelWalker`, do not shorten chains.
+ */
+struct Summary {
+    size_t row_ends   = std::numeric_limits<size_t>::max();
+    size_t chain_ends = std::numeric_limits<size_t>::max();
+    bool   run_length = false;
+};
+
+/**
+ * @brief Limits on how much of a data structure a `Dot` loads
+ * @details Nodes which are not shown because of a limit are replaced by a
+ *          stub node `… N more`, one for each node that has edges to them.
+ *          An edge to a node which is not shown for another reason waits for
+ *          the node to be named, as it does without a budget.
+ *          The node and byte limits count everything added to the `Dot`, the
+ *          time limit counts from the start of each `load_ds`.
+ */
+struct Budget {
+    size_t   max_nodes = std::numeric_limits<size_t>::max();
+    unsigned max_depth = std::numeric_limits<unsigned>::max();
+    size_t   max_bytes = std::numeric_limits<size_t>::max();
+    std::chrono::steady_clock::duration time_limit =
+        std::chrono::steady_clock::duration::max();
 };
 
 /**
@@ -88,6 +713,11 @@ class IViz {
      */
     virtual std::string print() const = 0;
 
+    /**
+     * @brief Write the graphviz dot file to a stream
+     */
+    virtual void write(std::ostream &out) const { out << print(); }
+
     /**
      * @brief Generate a unique port name
      * @return The port name `_portN`
@@ -143,7 +773,7 @@ class IViz {
      * @param edge The edge label
      */
     virtual void addEdge(void *from, void *to, std::string edge = "") {
-        addEdge(getName(from), getName(to), edge);
+        addEdge(getName(from), to, edge);
     }
 
     /**
@@ -165,6 +795,14 @@ class IViz {
      */
     virtual void addSubGraph(std::string sg) = 0;
 
+    /**
+     * @brief Add a subgraph which is written out when the graph is printed
+     * @details By default the cluster is rendered at once and passed to
+     *          `addSubGraph`. `Dot` and `SubGraph` keep it as it is, so nested
+     *          subgraphs are moved into their parent instead of copied.
+     */
+    virtual void addCluster(std::unique_ptr<Cluster> cluster);
+
     /**
      * @brief Set the name of a node
      * @param ds The pointer to the node
@@ -188,314 +826,1026 @@ class IViz {
 
     /**
      * @brief Load a data structure to the graph
-     * @details This function will start a depth-first search from the root node.
+     * @details This function will start a traversal from the root node.
      *          Then all the nodes are able to reached will be added to the graph.
+     *          Nodes reached while another node is being shown are put on a
+     *          worklist and expanded after that node is finished, so the
+     *          traversal never recurses into `dsviz_show`.
      * @param ds The pointer to the data structure
      */
     virtual void load_ds(IDataStructure *ds) {
-        if (!hasNode(ds)) {
-            ds->dsviz_show(*this);
-        }
+        if (typed) reached(ds, typeid(*ds));
+        visit(ds, &showDS);
     }
 
     /**
      * @brief Load a data structure to the graph
-     * @details This function will start a depth-first search from the root node.
-     *          Then all the nodes are able to reached will be added to the graph.
+     * @details Same as `load_ds`, but calls `dsviz_show(T*, IViz&)` instead of
+     *          a member function, so T does not need to be modified.
      * @param ds The pointer to the data structure
      */
     template <class T> void load_ds_c(T *ds) {
-        if (!hasNode(ds)) {
-            dsviz_show(ds, *this);
-        }
+        if (typed) reached(ds, typeid(T));
+        visit(ds, &showC<T>);
     }
 
+    /**
+     * @brief Set the order that `load_ds` expands nodes in
+     * @param order Depth-first (the default) or breadth-first
+     */
+    void  setOrder(Order order) { this->order = order; }
+    Order getOrder() const { return order; }
+
+    /**
+     * @brief Escape a string for a graphviz HTML label
+     * @return The escaped string
+     */
     inline static std::string encode(std::string data) {
         std::string ans;
-        for (auto c : data) {
-            if (c == '<') {
-                ans += "&lt;";
-                continue;
-            }
-            if (c == '>') {
-                ans += "&gt;";
-                continue;
-            }
-            if (c == '=' || c == '?' || c == ':' || c == '&' || c == '^' ||
-                c == '~' || c == '*' || c == '%' || c == '/' || c == '(' ||
-                c == ')' || c == ';' || c == '[' || c == ']' || c == '{' ||
-                c == '}') {
-                ans += "&#";
-                int ascii = (int)c;
-                ans += std::to_string(ascii);
-                ans += ';';
-                continue;
-            }
-            ans += c;
-        }
+#if DSVIZ_STATS
+        encodedBytes() += data.size();
+#endif
+        HtmlEncoder::append(ans, data.data(), data.size());
         return ans;
     }
-};
 
-/**
- * @brief A class representing a node in graphviz dot file
- */
-class Node {
-  public:
-    Node(IViz &viz, std::string name = "", std::string shape = "",
-         std::string style = "")
-        : viz(viz), shape(shape), style(style) {
-        if (name == "")
-            this->name = viz.genNodeName();
-        else
-            this->name = name;
-        ss << "[";
+    /**
+     * @brief Escape a string for a graphviz HTML label, appending it to `out`
+     */
+    inline static void encode(std::string &out, StrRef data) {
+#if DSVIZ_STATS
+        encodedBytes() += data.size();
+#endif
+        HtmlEncoder::append(out, data.data(), data.size());
     }
-    virtual ~Node() { Done(); }
 
-    virtual void Done() {
-        if (isDone) return;
-        this->genShape();
-        this->genLabel();
-        this->genStyle();
-        for (auto &p : other_attrs)
-            genAttr(p.first, p.second);
-        ss << "]";
-        viz.addNode(this->name, ss.str());
-        isDone = true;
-    }
+    /**
+     * @brief Decide whether a node taken from the worklist is shown now
+     * @details By default a node is shown if it has no name yet. A graph
+     *          shared by several threads claims the node atomically instead.
+     * @return True if the caller should call `dsviz_show` for the node
+     */
+    virtual bool claim(void *ds) { return !hasNode(ds); }
 
-    virtual void addEdge(IDataStructure *ds, std::string edge_label = "",
-                         std::string edge = "") {
-        if (ds != nullptr) {
-            viz.load_ds(ds);
-            if (edge_label != "") edge += " label=\"" + edge_label + "\"";
-            viz.addEdge(this->name, ds, "[" + edge + "]");
-        }
-    }
+    /**
+     * @brief The recorder which table nodes send their rows to
+     * @return nullptr if table nodes should format their own labels
+     */
+    virtual Recorder *recorder() { return nullptr; }
 
-    virtual void addAttr(std::string attr, std::string value) {
-        other_attrs[attr] = value;
+    /**
+     * @brief Decide whether the budget of the traversal allows one more node
+     * @param depth The distance of the node from the node `load_ds` started at
+     * @return True if the node can be shown
+     */
+    virtual bool admit(unsigned depth) {
+        (void)depth;
+        return true;
     }
 
-    std::string name, label, shape, style;
-
-  protected:
-    virtual void genAttr(std::string name, const std::string &attr) {
-        if (!attr.empty()) ss << " " << name << "=\"" << attr << "\"";
+    /**
+     * @brief How table nodes shorten their rows, see `Summary`
+     */
+    virtual const Summary &summary() const {
+        static const Summary all;
+        return all;
     }
 
-    virtual void genLabel() { genAttr("label", label); }
-    virtual void genShape() { genAttr("shape", shape); }
-    virtual void genStyle() { genAttr("style", style); }
+    /**
+     * @brief The limits which `admit` applies, see `Budget`
+     */
+    virtual Budget getBudget() const { return Budget(); }
 
-    IViz &viz;
-    bool  isDone = false;
+  protected:
+    friend class ParallelWalker;
+    friend class ConsistentWalker;
+    friend class Explorer;
+    typedef void (*ShowFn)(void *, IViz &);
 
-    std::stringstream                  ss;
-    std::map<std::string, std::string> other_attrs;
-};
+    /**
+     * @brief A node waiting on the worklist to be shown
+     */
+    struct Pending {
+        void    *ds;
+        ShowFn   show;
+        unsigned depth;
+        size_t   chain; // nodes before it on its chain, see `Summary`
+    };
+
+    /**
+     * @brief Show `ds` and everything reachable from it
+     * @details The first call drains the worklist; calls made while a node is
+     *          being shown only queue the node. A node is marked visited by
+     *          `setName`, so it is checked again when it is popped.
+     */
+    void visit(void *ds, ShowFn show) {
+        if (hasNode(ds)) {
+#if DSVIZ_STATS
+            ++walkStats.duplicates;
+#endif
+            return;
+        }
+        Pending p = {ds, show, 0, 0};
+        if (walking) {
+            children.push_back(p);
+            return;
+        }
+        walking = true;
+        startWalk();
+        size_t ends = std::max<size_t>(summary().chain_ends, 1);
+        worklist.push_back(p);
+        while (!worklist.empty()) {
+            if (order == Order::DFS) {
+                p = worklist.back();
+                worklist.pop_back();
+            } else {
+                p = worklist.front();
+                worklist.pop_front();
+            }
+            if (!claim(p.ds)) {
+#if DSVIZ_STATS
+                ++walkStats.duplicates;
+#endif
+                continue;
+            }
+            if (p.chain >= ends && elide(p)) continue;
+            if (!admit(p.depth)) continue;
+#if DSVIZ_STATS
+            auto shown = std::chrono::steady_clock::now();
+            p.show(p.ds, *this);
+            walkStats.showTime += std::chrono::steady_clock::now() - shown;
+            ++walkStats.shows;
+#else
+            p.show(p.ds, *this);
+#endif
+            for (auto &c : children)
+                c.depth = p.depth + 1;
+            if (children.size() == 1) children[0].chain = p.chain + 1;
+            // children are pushed reversed for DFS so the first one is shown
+            // first, the same order a recursive walk would produce
+            if (order == Order::DFS)
+                worklist.insert(worklist.end(), children.rbegin(),
+                                children.rend());
+            else
+                worklist.insert(worklist.end(), children.begin(),
+                                children.end());
+            children.clear();
+        }
+        walking = false;
+        finishWalk();
+    }
+
+    /**
+     * @brief Count the rest of a chain into one `… N more` node
+     * @details The nodes from `p` on are shown into a `ChainCounter` for as
+     *          long as each loads one new node, and are named after the new
+     *          node, so edges to them end there. A node which loads several
+     *          is queued to be shown, with an edge from the new node.
+     * @return False if `p` itself loads several nodes and is to be shown
+     */
+    bool elide(Pending p);
+
+    /**
+     * @brief Called with every pointer passed to `load_ds` and its type
+     * @details Only called if `typed` is set. A `Mock` reports the type it
+     *          mocks again when it is shown.
+     */
+    virtual void reached(void *ds, const std::type_info &type) {
+        (void)ds;
+        (void)type;
+    }
+
+    /**
+     * @brief Called before the outermost `load_ds` starts showing nodes
+     */
+    virtual void startWalk() {}
+
+    /**
+     * @brief Called after the outermost `load_ds` has shown all nodes
+     */
+    virtual void finishWalk() {}
+
+    template <class T, void (*F)(T *, IViz &)> friend class Mock;
+
+#if DSVIZ_STATS
+    /**
+     * @brief Called by `Mock` after showing one of its nodes
+     */
+    virtual void shownType(const std::type_info &,
+                           std::chrono::steady_clock::duration) {}
+
+    static size_t &encodedBytes() {
+        static thread_local size_t n = 0;
+        return n;
+    }
+
+    struct WalkStats {
+        size_t                              shows      = 0;
+        size_t                              duplicates = 0;
+        std::chrono::steady_clock::duration showTime{};
+    } walkStats;
+#endif
+
+  private:
+    static void showDS(void *ds, IViz &viz) {
+        static_cast<IDataStructure *>(ds)->dsviz_show(viz);
+    }
+    template <class T> static void showC(void *ds, IViz &viz) {
+        dsviz_show(static_cast<T *>(ds), viz);
+    }
+
+    template <class V> friend class VizRef;
+    template <class V> friend class BasicSubGraph;
+
+    // the walk is run by the V itself, so viz is always a V here
+    template <class V, class T> static void showAs(void *ds, IViz &viz) {
+        dsviz_show(static_cast<T *>(ds), static_cast<V &>(viz));
+    }
+
+  protected:
+    Order                order   = Order::DFS;
+    bool                 walking = false;
+    bool                 typed   = false; // call `reached`
+    std::deque<Pending>  worklist;
+    std::vector<Pending> children;
+};
+
+template <typename T, void (*F)(T *, IViz &)>
+void
+Mock<T, F>::dsviz_show(IViz &viz) {
+    if (viz.typed) viz.reached(this, typeid(T));
+    T *ds = static_cast<T *>(ptr);
+#if DSVIZ_STATS
+    auto start = std::chrono::steady_clock::now();
+    F(ds, viz);
+    viz.shownType(typeid(T), std::chrono::steady_clock::now() - start);
+#else
+    F(ds, viz);
+#endif
+}
+
+/**
+ * @brief Calls the methods of a viz whose type V is known at compile time
+ * @details If V is a concrete class, the calls are qualified with V, so they
+ *          are not virtual and can be inlined, and `load_ds_c` shows nodes
+ *          with `dsviz_show(T*, V&)`. The viz must then be a V and not a
+ *          class overriding its methods. If V is abstract, like `IViz`, the
+ *          calls stay virtual.
+ */
+template <class V> class VizRef {
+  public:
+    explicit VizRef(V &v) : v(v) {}
+
+    V &get() const { return v; }
+
+#define DSVIZ_VIZREF_CALL(f)                                                   \
+    template <class... A>                                                      \
+    auto f(A &&...a) const                                                     \
+        ->decltype(std::declval<V &>().f(std::forward<A>(a)...)) {             \
+        return f##_(Erased(), std::forward<A>(a)...);                          \
+    }                                                                          \
+                                                                               \
+  private:                                                                     \
+    template <class... A>                                                      \
+    auto f##_(std::true_type, A &&...a) const                                  \
+        ->decltype(std::declval<V &>().f(std::forward<A>(a)...)) {             \
+        return v.f(std::forward<A>(a)...);                                     \
+    }                                                                          \
+    template <class... A>                                                      \
+    auto f##_(std::false_type, A &&...a) const                                 \
+        ->decltype(std::declval<V &>().f(std::forward<A>(a)...)) {             \
+        return v.V::f(std::forward<A>(a)...);                                  \
+    }                                                                          \
+                                                                               \
+  public:
+
+    DSVIZ_VIZREF_CALL(load_ds)
+    DSVIZ_VIZREF_CALL(setName)
+    DSVIZ_VIZREF_CALL(getName)
+    DSVIZ_VIZREF_CALL(getDS)
+    DSVIZ_VIZREF_CALL(addEdge)
+    DSVIZ_VIZREF_CALL(addNode)
+    DSVIZ_VIZREF_CALL(addSubGraph)
+    DSVIZ_VIZREF_CALL(addCluster)
+    DSVIZ_VIZREF_CALL(hasNode)
+    DSVIZ_VIZREF_CALL(claim)
+    DSVIZ_VIZREF_CALL(admit)
+    DSVIZ_VIZREF_CALL(summary)
+    DSVIZ_VIZREF_CALL(recorder)
+    DSVIZ_VIZREF_CALL(genNodeName)
+    DSVIZ_VIZREF_CALL(genEdgeName)
+    DSVIZ_VIZREF_CALL(genPortName)
+#undef DSVIZ_VIZREF_CALL
+
+    template <class T> void load_ds_c(T *ds) const { loadC(Erased(), ds); }
+
+  private:
+    typedef std::integral_constant<bool, std::is_abstract<V>::value> Erased;
+
+    template <class T> void loadC(std::true_type, T *ds) const {
+        v.load_ds_c(ds);
+    }
+    template <class T> void loadC(std::false_type, T *ds) const {
+        IViz &viz = v;
+        if (viz.typed) viz.reached(ds, typeid(T));
+        viz.visit(ds, &IViz::template showAs<V, T>);
+    }
+
+    V &v;
+};
+
+/**
+ * @brief Show a node with `dsviz_show(T*, V&)` and calls resolved for V
+ * @details The statically dispatched counterpart of `IViz::load_ds_c`. Write
+ *          `dsviz_show` as a template on the viz type and build the nodes
+ *          with `BasicTableNode<V>`, and the whole walk is inlined.
+ */
+template <class V, class T>
+void
+load_ds_c(V &viz, T *ds) {
+    VizRef<V>(viz).load_ds_c(ds);
+}
+
+/**
+ * @brief A class representing a node in graphviz dot file
+ * @param V The type of the viz, see `VizRef`
+ */
+template <class V> class BasicNode {
+  public:
+    BasicNode(V &viz, std::string name = "", std::string shape = "",
+              std::string style = "")
+        : viz(viz), shape(std::move(shape)), style(std::move(style)) {
+        if (name == "")
+            this->name = this->viz.genNodeName();
+        else
+            this->name = std::move(name);
+    }
+    virtual ~BasicNode() { Done(); }
+
+    virtual void Done() {
+        if (isDone) return;
+        body.reserve(label.size() + shape.size() + style.size() + 32);
+        body += "[";
+        this->genShape();
+        this->genLabel();
+        this->genStyle();
+        for (auto &p : other_attrs)
+            genAttr(p.first, p.second);
+        body += "]";
+        viz.addNode(this->name, std::move(body));
+        isDone = true;
+    }
+
+    virtual void addEdge(IDataStructure *ds, std::string edge_label = "",
+                         std::string edge = "") {
+        if (ds != nullptr) {
+            viz.load_ds(ds);
+            viz.addEdge(this->name, ds, edgeAttr(edge_label, edge));
+        }
+    }
+
+    /**
+     * @brief Add an edge to a node shown by `dsviz_show(T*, IViz&)`
+     * @details The pointer itself is used as the key of the node, so no mock
+     *          object is needed.
+     */
+    template <class T>
+    void addEdgeC(T *ds, std::string edge_label = "", std::string edge = "") {
+        if (ds != nullptr) {
+            viz.load_ds_c(ds);
+            viz.addEdge(this->name, ds, edgeAttr(edge_label, edge));
+        }
+    }
+
+    virtual void addAttr(std::string attr, std::string value) {
+        other_attrs[std::move(attr)] = std::move(value);
+    }
+
+    std::string name, label, shape, style;
+
+  protected:
+    virtual void genAttr(std::string name, const std::string &attr) {
+        if (attr.empty()) return;
+        body += " ";
+        body += name;
+        body += "=\"";
+        body += attr;
+        body += "\"";
+    }
+
+    // `[edge label="edge_label"]`, built with one allocation
+    static std::string edgeAttr(StrRef edge_label, StrRef edge) {
+        std::string attr;
+        attr.reserve(edge.size() + edge_label.size() + 12);
+        attr += "[";
+        attr += edge;
+        if (!edge_label.empty()) {
+            attr += " label=\"";
+            attr += edge_label;
+            attr += "\"";
+        }
+        attr += "]";
+        return attr;
+    }
+
+    virtual void genLabel() { genAttr("label", label); }
+    virtual void genShape() { genAttr("shape", shape); }
+    virtual void genStyle() { genAttr("style", style); }
+
+    VizRef<V> viz;
+    bool      isDone = false;
+
+    std::string                        body; // the attributes, built by Done
+    std::map<std::string, std::string> other_attrs;
+};
+
+typedef BasicNode<IViz> Node;
+
+/**
+ * @brief A field name whose cell is encoded once and reused
+ */
+struct FieldLabel {
+    explicit FieldLabel(std::string name, std::string attr = "")
+        : name(name), attr(attr) {
+        cell = "<td ";
+        IViz::encode(cell, attr);
+        cell += ">";
+        IViz::encode(cell, name);
+        cell += "</td>";
+        edge = "[ label=\"" + name + "\"]";
+    }
+
+    std::string name, attr;
+    std::string cell; // the <td> of the name
+    std::string edge; // the attributes of an edge labelled with the name
+};
 
 /**
  * @brief A class representing a table node in graphviz dot file
  *        such as:
  *          node [lable=< <table border='0' cellborder='1' cellspacing='0'>...</table> >]
+ * @param V The type of the viz, see `VizRef`
  */
-class TableNode : public Node {
+template <class V> class BasicTableNode : public BasicNode<V> {
+    typedef BasicNode<V> Base;
+
   public:
-    TableNode(IViz &viz, int span = 1, std::string name = "",
-              std::string shape = "", std::string style = "")
-        : Node(viz, name, shape, style), span(span) {
-        tss << "<table border='0' cellborder='1' cellspacing='0' "
-               "cellpadding='2'>";
+    typedef FieldLabel Label;
+
+    using Base::Done;
+    using Base::label;
+    using Base::name;
+    using Base::shape;
+    using Base::style;
+
+    BasicTableNode(V &viz, int span = 1, std::string name = "",
+                   std::string shape = "", std::string style = "")
+        : Base(viz, name, shape, style), span(span),
+          rec(this->viz.recorder()) {
+        if (rec) {
+            handle = rec->beginNode(this->name, span);
+        } else {
+            table.reserve(sizeHint());
+            table = "<table border='0' cellborder='1' cellspacing='0' "
+                    "cellpadding='2'>";
+        }
     }
-    virtual ~TableNode() {
-        tss << "</table>";
-        label = tss.str();
+    virtual ~BasicTableNode() {
+        if (rec) {
+            rec->endNode(handle, shape, style, other_attrs);
+            isDone = true;
+            return;
+        }
+        table += "</table>";
+        sizeHint() = table.size();
+        label      = std::move(table);
         Done();
     }
 
-    inline void attr_name(std::string name, std::string attr) {
-        tss << "<td " << IViz::encode(attr) << ">" << IViz::encode(name)
-            << "</td>";
+    /**
+     * @brief Reserve room for a label of about `bytes` bytes
+     * @details By default the room reserved is the size of the last table
+     *          node built for this viz type.
+     */
+    void reserve(size_t bytes) {
+        if (!rec) table.reserve(bytes);
+    }
+
+    inline void beginRow() {
+        if (rec)
+            rec->beginRow(handle);
+        else
+            table += "<tr>";
+    }
+
+    inline void endRow() {
+        if (rec)
+            rec->endRow(handle);
+        else
+            table += "</tr>";
+    }
+
+    inline void attr_name(const Label &label) {
+        if (rec) return rec->cellName(handle, label.name, label.attr);
+        table += label.cell;
+    }
+
+    inline void attr_name(StrRef name, StrRef attr) {
+        if (rec) return rec->cellName(handle, name, attr);
+        table += "<td ";
+        IViz::encode(table, attr);
+        table += ">";
+        IViz::encode(table, name);
+        table += "</td>";
     }
 
-    inline void attr_value(std::string value, std::string attr,
-                           std::string pt_name = "") {
-        tss << "<td";
-        if (span != 1) tss << " colspan='" << span << "'";
-        if (!pt_name.empty()) tss << " PORT='" << pt_name << "'";
-        tss << " " << IViz::encode(attr) << ">" << IViz::encode(value)
-            << "</td>";
+    inline void attr_value(StrRef value, StrRef attr, StrRef pt_name = "") {
+        if (rec)
+            return rec->cellValue(handle, Value::of(value), attr, pt_name,
+                                  true);
+        table += "<td";
+        colspan(true);
+        port(pt_name);
+        table += " ";
+        IViz::encode(table, attr);
+        table += ">";
+        IViz::encode(table, value);
+        table += "</td>";
     }
 
-    inline void attr_value_nospan(std::string value, std::string attr,
-                                  std::string pt_name = "") {
-        tss << "<td";
-        if (!pt_name.empty()) tss << " PORT='" << pt_name << "'";
-        tss << " " << IViz::encode(attr) << ">" << IViz::encode(value)
-            << "</td>";
+    inline void attr_value_nospan(StrRef value, StrRef attr,
+                                  StrRef pt_name = "") {
+        if (rec)
+            return rec->cellValue(handle, Value::of(value), attr, pt_name,
+                                  false);
+        table += "<td";
+        port(pt_name);
+        table += " ";
+        IViz::encode(table, attr);
+        table += ">";
+        IViz::encode(table, value);
+        table += "</td>";
     }
 
+    /**
+     * @brief Add a row of a name and a value
+     * @details Strings are escaped and numbers and bools are formatted. A
+     *          value of any other type is formatted with `to_string(value)`,
+     *          which can be declared next to the type. `add` can no longer be
+     *          specialized for a type, as `TableNode::add` could before
+     *          `TableNode` became a template.
+     */
     template <typename T>
-    inline void add(std::string name, T number, std::string attr = "",
-                    std::string attr2 = "") {
-        tss << "<tr>";
+    inline void add(StrRef name, const T &value, StrRef attr = "",
+                    StrRef attr2 = "") {
+        beginRow();
         attr_name(name, attr);
-        attr_value(std::to_string(number), attr2.empty() ? attr : attr2);
-        tss << "</tr>";
+        cell(value, attr2.empty() ? attr : attr2);
+        endRow();
+    }
+
+    template <typename T> inline void add(const Label &name, const T &value) {
+        beginRow();
+        attr_name(name);
+        cell(value, name.attr);
+        endRow();
+    }
+
+    /**
+     * @brief Add a row with a port and an edge from it to a pointer
+     */
+    template <class T> inline void addPointerC(const Label &name, T *ds) {
+        if (ds == nullptr) return;
+        std::string pt_name = viz.genPortName();
+
+        beginRow();
+        attr_name(name);
+        attr_value("", name.attr, pt_name);
+        endRow();
+        viz.load_ds_c(ds);
+        viz.addEdge(portOf(pt_name), ds);
     }
 
-    inline void addPointer(std::string name, IDataStructure *ds,
-                           std::string content = "", std::string attr = "",
-                           std::string attr2 = "", std::string edge = "") {
+    inline void addPointer(StrRef name, IDataStructure *ds,
+                           StrRef content = "", StrRef attr = "",
+                           StrRef attr2 = "", StrRef edge = "") {
         if (ds == nullptr) return;
         std::string pt_name = viz.genPortName();
 
-        tss << "<tr>";
+        beginRow();
         attr_name(name, attr);
         attr_value(content, attr2.empty() ? attr : attr2, pt_name);
-        tss << "</tr>";
+        endRow();
         if (ds != nullptr) {
             viz.load_ds(ds);
-            viz.addEdge(this->name + ":" + pt_name, ds, edge);
+            viz.addEdge(portOf(pt_name), ds, edge.str());
         }
     }
 
-    inline void addLeftRightSubTree(std::string name, IDataStructure *left,
+    inline void addLeftRightSubTree(StrRef name, IDataStructure *left,
                                     IDataStructure *right,
-                                    std::string     content_left  = "",
-                                    std::string     content_right = "",
-                                    std::string     attr          = "",
-                                    std::string     attr2         = "") {
+                                    StrRef          content_left  = "",
+                                    StrRef          content_right = "",
+                                    StrRef          attr          = "",
+                                    StrRef          attr2         = "") {
         if (left == nullptr && right == nullptr) return;
         std::string pt_name_l = viz.genPortName();
         std::string pt_name_r = viz.genPortName();
-        tss << "<tr>";
+        beginRow();
         attr_name(name, attr);
         attr_value_nospan(content_left, attr2.empty() ? attr : attr2,
                           pt_name_l);
         attr_value_nospan(content_right, attr2.empty() ? attr : attr2,
                           pt_name_r);
-        tss << "</tr>";
+        endRow();
         if (left != nullptr) {
             viz.load_ds(left);
-            viz.addEdge(this->name + ":" + pt_name_l, left);
+            viz.addEdge(portOf(pt_name_l), left);
         }
         if (right != nullptr) {
             viz.load_ds(right);
-            viz.addEdge(this->name + ":" + pt_name_r, right);
+            viz.addEdge(portOf(pt_name_r), right);
         }
     }
 
-    inline void
-    addChildren(std::string name, IDataStructure **children, size_t size,
-                std::vector<std::string> content = std::vector<std::string>(0),
-                std::string attr = "", std::string attr2 = "") {
-        tss << "<tr>";
+    inline void addChildren(StrRef name, IDataStructure **children,
+                            size_t                          size,
+                            const std::vector<std::string> &content = {},
+                            StrRef attr = "", StrRef attr2 = "") {
+        beginRow();
         attr_name(name, attr);
+        size_t head, tail;
+        rowEnds(size, head, tail);
         for (size_t i = 0; i < size; ++i) {
+            if (i == head) {
+                elided(size - head - tail, attr2.empty() ? attr : attr2);
+                if ((i = size - tail) == size) break;
+            }
             std::string pt_name   = viz.genPortName();
-            std::string content_i = content.size() > i ? content[i] : "";
+            StrRef      content_i = content.size() > i ? content[i] : "";
             attr_value_nospan(content_i, attr2.empty() ? attr : attr2, pt_name);
 
             if (children[i] != nullptr) {
                 viz.load_ds(children[i]);
-                viz.addEdge(this->name + ":" + pt_name, children[i]);
+                viz.addEdge(portOf(pt_name), children[i]);
             }
         }
-        tss << "</tr>";
+        endRow();
     }
 
     template <class T>
-    inline void addPointerC(std::string name, T *ds, std::string content = "",
-                            std::string attr = "", std::string attr2 = "") {
+    inline void addPointerC(StrRef name, T *ds, StrRef content = "",
+                            StrRef attr = "", StrRef attr2 = "") {
         if (ds == nullptr) return;
         std::string pt_name = viz.genPortName();
 
-        tss << "<tr>";
+        beginRow();
         attr_name(name, attr);
         attr_value(content, attr2.empty() ? attr : attr2, pt_name);
-        tss << "</tr>";
+        endRow();
         if (ds != nullptr) {
             viz.load_ds_c(ds);
-            viz.addEdge(this->name + ":" + pt_name, ds);
+            viz.addEdge(portOf(pt_name), ds);
         }
     }
 
     template <class T>
-    inline void
-    addChildrenC(std::string name, T **children, size_t size,
-                 std::vector<std::string> content = std::vector<std::string>(0),
-                 std::string attr = "", std::string attr2 = "") {
-        tss << "<tr>";
+    inline void addChildrenC(StrRef name, T **children, size_t size,
+                             const std::vector<std::string> &content = {},
+                             StrRef attr = "", StrRef attr2 = "") {
+        beginRow();
         attr_name(name, attr);
+        size_t head, tail;
+        rowEnds(size, head, tail);
         for (size_t i = 0; i < size; ++i) {
+            if (i == head) {
+                elided(size - head - tail, attr2.empty() ? attr : attr2);
+                if ((i = size - tail) == size) break;
+            }
             std::string pt_name = viz.genPortName();
-            attr_value_nospan(i < content.size() ? content[i] : " ",
+            attr_value_nospan(i < content.size() ? StrRef(content[i]) : " ",
                               attr2.empty() ? attr : attr2, pt_name);
 
             if (children[i] != nullptr) {
                 viz.load_ds_c(children[i]);
-                viz.addEdge(this->name + ":" + pt_name, children[i]);
+                viz.addEdge(portOf(pt_name), children[i]);
             }
         }
-        tss << "</tr>";
+        endRow();
     }
 
     template <class T>
-    inline void addArray(std::string name, T *numbers, size_t size,
-                         std::string attr = "", std::string attr2 = "") {
-        tss << "<tr>";
+    inline void addArray(StrRef name, T *numbers, size_t size,
+                         StrRef attr = "", StrRef attr2 = "") {
+        beginRow();
         attr_name(name, attr);
-        for (size_t i = 0; i < size; ++i) {
-            attr_value_nospan(std::to_string(numbers[i]),
-                              attr2.empty() ? attr : attr2);
+        StrRef a = attr2.empty() ? attr : attr2;
+        if (viz.summary().run_length) {
+            addRuns(numbers, size, a);
+        } else {
+            size_t head, tail;
+            rowEnds(size, head, tail);
+            for (size_t i = 0; i < size; ++i) {
+                if (i == head) {
+                    elided(size - head - tail, a);
+                    if ((i = size - tail) == size) break;
+                }
+                attr_number(numbers[i], a, false);
+            }
         }
-        tss << "</tr>";
+        endRow();
     }
 
     virtual void genArrowAttr(std::string name, const std::string &attr) {
-        if (!attr.empty()) ss << " " << name << "=<" << attr << ">";
+        if (attr.empty()) return;
+        body += " ";
+        body += name;
+        body += "=<";
+        body += attr;
+        body += ">";
     }
 
     virtual void genLabel() override { genArrowAttr("label", label); }
 
+  protected:
+    using Base::viz;
+    using Base::isDone;
+    using Base::body;
+    using Base::other_attrs;
+
   private:
-    int               span;
-    std::stringstream tss;
+    static size_t &sizeHint() {
+        static thread_local size_t n = 256;
+        return n;
+    }
+
+    // `name:pt_name`, the source of an edge from a port
+    std::string portOf(const std::string &pt_name) const {
+        std::string from;
+        from.reserve(name.size() + pt_name.size() + 1);
+        from += name;
+        from += ":";
+        from += pt_name;
+        return from;
+    }
+
+    // the cells kept at the start and at the end of a row of `size` cells
+    void rowEnds(size_t size, size_t &head, size_t &tail) {
+        size_t k = viz.summary().row_ends;
+        head     = size;
+        tail     = 0;
+        if (k < size && size - k > k + 1) head = tail = k;
+    }
+
+    void elided(size_t n, StrRef attr) {
+        attr_value_nospan("\xe2\x80\xa6 " + std::to_string(n) +
+                              " elided \xe2\x80\xa6",
+                          attr);
+    }
+
+    // equal neighbours as one cell, keeping `row_ends` cells at each end
+    template <class T>
+    void addRuns(const T *numbers, size_t size, StrRef attr) {
+        size_t k = viz.summary().row_ends, i = 0;
+        for (size_t cells = 0; i < size && cells < k; ++cells) {
+            size_t j = i + 1;
+            while (j < size && numbers[j] == numbers[i])
+                ++j;
+            run(numbers[i], j - i, attr);
+            i = j;
+        }
+        // the runs at the end, found backwards
+        std::vector<std::pair<size_t, size_t>> tail;
+        size_t                                 end = size;
+        while (end > i && tail.size() < k) {
+            size_t begin = end - 1;
+            while (begin > i && numbers[begin - 1] == numbers[end - 1])
+                --begin;
+            tail.push_back(std::make_pair(begin, end));
+            end = begin;
+        }
+        if (end > i) elided(end - i, attr);
+        for (auto r = tail.rbegin(); r != tail.rend(); ++r)
+            run(numbers[r->first], r->second - r->first, attr);
+    }
+
+    template <class T> void run(const T &number, size_t n, StrRef attr) {
+        if (n == 1) return attr_number(number, attr, false);
+        attr_value_nospan(std::to_string(number) + " \xc3\x97" +
+                              std::to_string(n),
+                          attr);
+    }
+
+    void colspan(bool spanned) {
+        if (!spanned || span == 1) return;
+        table += " colspan='";
+        table += std::to_string(span);
+        table += "'";
+    }
+
+    void port(StrRef pt_name) {
+        if (pt_name.empty()) return;
+        table += " PORT='";
+        table += pt_name;
+        table += "'";
+    }
+
+    void cell(const std::string &str, StrRef attr) { attr_value(str, attr); }
+    void cell(StrRef str, StrRef attr) { attr_value(str, attr); }
+    void cell(const char *str, StrRef attr) { attr_value(str, attr); }
+
+    void cell(bool b, StrRef attr) {
+        if (rec)
+            rec->cellValue(handle, Value::of(b), attr, "", true);
+        else
+            attr_value(b ? "true" : "false", attr);
+    }
+
+    template <class T> void cell(T number, StrRef attr) {
+        attr_number(number, attr, true);
+    }
+
+    template <class T> void attr_number(T number, StrRef attr, bool spanned) {
+        attr_number(number, attr, spanned,
+                    std::integral_constant<bool, Value::IsRaw<T>::value>());
+    }
+
+    template <class T>
+    void attr_number(T number, StrRef attr, bool spanned, std::true_type) {
+        if (rec)
+            return rec->cellValue(handle, Value::of(number), attr, "",
+                                  spanned);
+        // a formatted number has nothing to escape
+        table += "<td";
+        colspan(spanned);
+        table += " ";
+        IViz::encode(table, attr);
+        table += ">";
+        table += std::to_string(number);
+        table += "</td>";
+    }
+
+    template <class T>
+    void attr_number(T number, StrRef attr, bool spanned, std::false_type) {
+        // a type of the user's own is formatted by its to_string, found by ADL
+        using std::to_string;
+        if (spanned)
+            attr_value(to_string(number), attr);
+        else
+            attr_value_nospan(to_string(number), attr);
+    }
+
+    int         span;
+    std::string table;
+    Recorder   *rec;
+    uint32_t    handle = 0;
 };
 
-template <>
-inline void
-TableNode::add<std::string>(std::string name, std::string str, std::string attr,
-                            std::string attr2) {
-    tss << "<tr>";
-    attr_name(name, attr);
-    attr_value(str, attr2.empty() ? attr : attr2);
-    tss << "</tr>";
+typedef BasicTableNode<IViz> TableNode;
+
+/**
+ * @brief A member shown as a row of its name and value
+ */
+template <class C, class M> struct ValueField {
+    const char *name;
+    M C::*member;
+};
+
+/**
+ * @brief A pointer member shown as a row with an edge from its port
+ */
+template <class C, class M> struct PointerField {
+    const char *name;
+    M *C::*member;
+};
+
+/**
+ * @brief A pointer member shown as an edge labelled with its name
+ */
+template <class C, class M> struct EdgeField {
+    const char *name;
+    M *C::*member;
+};
+
+template <class C, class M>
+ValueField<C, M>
+field(const char *name, M C::*member) {
+    return ValueField<C, M>{name, member};
 }
 
-template <>
-inline void
-TableNode::add<bool>(std::string name, bool b, std::string attr,
-                     std::string attr2) {
-    tss << "<tr>";
-    attr_name(name, attr);
-    attr_value(b ? "true" : "false", attr2.empty() ? attr : attr2);
-    tss << "</tr>";
+template <class C, class M>
+PointerField<C, M>
+pointer(const char *name, M *C::*member) {
+    return PointerField<C, M>{name, member};
 }
 
-template <>
-inline void
-TableNode::add<const char *>(std::string name, const char *str,
-                             std::string attr, std::string attr2) {
-    tss << "<tr>";
-    attr_name(name, attr);
-    attr_value(std::string(str), attr2.empty() ? attr : attr2);
-    tss << "</tr>";
+template <class C, class M>
+EdgeField<C, M>
+edge(const char *name, M *C::*member) {
+    return EdgeField<C, M>{name, member};
 }
 
+/**
+ * @brief Shows a type from the fields listed by `DSVIZ_FIELDS`
+ * @details The labels of the fields are encoded once per type, and every
+ *          field is shown by a call resolved at compile time, so showing a
+ *          node only formats its values. `show` is a template on the viz
+ *          type V, and its calls to the viz go through `VizRef<V>`, so with
+ *          a concrete V none of them are virtual.
+ */
+template <class T> class Fields {
+  public:
+    typedef decltype(dsviz_fields((T *)nullptr)) Tuple;
+    typedef FieldLabel                           Label;
+
+    template <class V> static void show(T *ds, V &v) {
+        static const Tuple              fields = dsviz_fields((T *)nullptr);
+        static const std::vector<Label> labels =
+            Each<std::tuple_size<Tuple>::value>::labels(fields);
+
+        VizRef<V>         viz(v);
+        BasicTableNode<V> node(v);
+        viz.setName(ds, node.name);
+        Each<std::tuple_size<Tuple>::value>::show(ds, viz, node, fields,
+                                                  labels.data());
+    }
+
+  private:
+    template <class V, class M>
+    static void showField(T *ds, const VizRef<V> &, BasicTableNode<V> &node,
+                          const ValueField<T, M> &f, const Label &label) {
+        node.add(label, ds->*f.member);
+    }
+
+    template <class V, class M>
+    static void showField(T *ds, const VizRef<V> &, BasicTableNode<V> &node,
+                          const PointerField<T, M> &f, const Label &label) {
+        node.addPointerC(label, ds->*f.member);
+    }
+
+    template <class V, class M>
+    static void showField(T *ds, const VizRef<V> &viz,
+                          BasicTableNode<V> &node, const EdgeField<T, M> &f,
+                          const Label &label) {
+        M *to = ds->*f.member;
+        if (to == nullptr) return;
+        viz.load_ds_c(to);
+        viz.addEdge(node.name, (void *)to, label.edge);
+    }
+
+    // the first N fields
+    template <size_t N, class Dummy = void> struct Each {
+        static std::vector<Label> labels(const Tuple &fields) {
+            std::vector<Label> l = Each<N - 1>::labels(fields);
+            l.emplace_back(std::get<N - 1>(fields).name);
+            return l;
+        }
+
+        template <class V>
+        static void show(T *ds, const VizRef<V> &viz, BasicTableNode<V> &node,
+                         const Tuple &fields, const Label *labels) {
+            Each<N - 1>::show(ds, viz, node, fields, labels);
+            showField(ds, viz, node, std::get<N - 1>(fields), labels[N - 1]);
+        }
+    };
+
+    template <class Dummy> struct Each<0, Dummy> {
+        static std::vector<Label> labels(const Tuple &) {
+            return std::vector<Label>();
+        }
+
+        template <class V>
+        static void show(T *, const VizRef<V> &, BasicTableNode<V> &,
+                         const Tuple &, const Label *) {}
+    };
+};
+
+/**
+ * @brief Generate `dsviz_show(T*, V&)` for a type from its fields
+ * @details Use it in the namespace of T, then show the type with
+ *          `load_ds_c`. `DSViz::load_ds_c(dot, ds)` instantiates it for the
+ *          concrete type of `dot`, and `dot.load_ds_c(ds)` for `IViz`:
+ *
+ *     DSVIZ_FIELDS(bst_node, DSViz::field("data", &bst_node::data),
+ *                  DSViz::edge("left", &bst_node::left),
+ *                  DSViz::edge("right", &bst_node::right))
+ */
+#define DSVIZ_FIELDS(T, ...)                                                   \
+    inline auto dsviz_fields(T *)->decltype(std::make_tuple(__VA_ARGS__)) {    \
+        return std::make_tuple(__VA_ARGS__);                                   \
+    }                                                                          \
+    template <class V> inline void dsviz_show(T *ds, V &viz) {                 \
+        DSViz::Fields<T>::show(ds, viz);                                       \
+    }
+
+
+/**
+ * @brief The order edges are written in
+ */
+enum class EdgeOrder : uint8_t {
+    Sorted,   // by source then target name
+    Inserted, // in the order they were first added
+};
 
 /**
  * @brief The configuration of the system
@@ -505,6 +1855,7 @@ struct Config {
     std::string edge_style{""};
     std::string graph_style{""};
     std::string other{""};
+    EdgeOrder   edge_order{EdgeOrder::Sorted};
 
     std::string genGraphStyle() const {
         std::stringstream ss;
@@ -524,7 +1875,8 @@ struct Config {
  */
 class Edge {
   public:
-    Edge(std::string from, std::string to) : from(from), to(to) {}
+    Edge(std::string from, std::string to)
+        : from(std::move(from)), to(std::move(to)) {}
     std::string from, to;
 
     bool operator<(const Edge &rhs) const {
@@ -535,33 +1887,452 @@ class Edge {
 };
 
 /**
- * @brief A class representing a subgraph in graphviz dot file
+ * @brief The edges of a graph, each stored once as four 32-bit ids
+ * @details An end `node:port` is split at the first `:`. Names generated by
+ *          `genNodeName` and `genPortName` are stored as their number, other
+ *          names and the attributes are interned, so adding an edge which is
+ *          already there only replaces its attributes and allocates nothing.
+ *          Edges are looked up in an open-addressing table of record indices,
+ *          like `PtrIndex`.
  */
-class SubGraph : public IViz {
+class EdgeStore {
   public:
-    SubGraph(IViz &viz, std::string name = "", std::string label = "",
-             Config config = {})
-        : viz(viz) {
-        ss << "subgraph cluster_" << name << " {" << std::endl;
-        if (!label.empty()) ss << "label = \"" << label << "\";" << std::endl;
-        ss << config.genGraphStyle() << std::endl;
+    /**
+     * @brief Add an edge, or replace the attributes of the same edge
+     * @return False if the edge was already there
+     */
+    bool add(StrRef from, StrRef to, StrRef attr) {
+        Key k;
+        end(from, k.from, k.fromPort);
+        end(to, k.to, k.toPort);
+        uint32_t a = intern(attr);
+
+        if ((records.size() + 1) * 2 > slots.size()) grow();
+        size_t mask = slots.size() - 1;
+        size_t i    = hash(k) & mask;
+        for (; slots[i] != npos; i = (i + 1) & mask) {
+            Record &r = records[slots[i]];
+            if (r.key == k) {
+                r.attr = a;
+                return false;
+            }
+        }
+        slots[i] = (uint32_t)records.size();
+        records.push_back(Record{k, a});
+        return true;
     }
-    virtual ~SubGraph() {
-        for (auto subgraph : subgraphs) {
-            ss << subgraph << std::endl;
+
+    size_t size() const { return records.size(); }
+    bool   empty() const { return records.empty(); }
+
+    /**
+     * @brief Call `f(from, to, attr)` with each edge in the given order
+     */
+    template <class F> void each(EdgeOrder order, F f) const {
+        std::string from, to;
+        auto        emit = [&](const Record &r) {
+            from.clear();
+            to.clear();
+            appendEnd(from, r.key.from, r.key.fromPort);
+            appendEnd(to, r.key.to, r.key.toPort);
+            f(from, to, names[r.attr]);
+        };
+        if (order == EdgeOrder::Inserted) {
+            for (auto &r : records)
+                emit(r);
+        } else {
+            for (uint32_t i : sortedOrder())
+                emit(records[i]);
         }
-        for (auto node : nodes) {
-            ss << node.first << " " << node.second << ";" << std::endl;
+    }
+
+  private:
+    enum : uint32_t { npos = 0xffffffffu };
+
+    // a name is a symbol: N << 1 for `_nodeN` or `_portN`, i << 1 | 1 for
+    // names[i]; an end without a port has the port npos
+    struct Key {
+        uint32_t from, fromPort, to, toPort;
+        bool     operator==(const Key &o) const {
+            return from == o.from && fromPort == o.fromPort && to == o.to &&
+                   toPort == o.toPort;
         }
-        for (auto edge : edges) {
-            ss << edge.first.from << " -> " << edge.first.to << " "
-               << edge.second << ";" << std::endl;
+    };
+
+    struct Record {
+        Key      key;
+        uint32_t attr; // index into names
+    };
+
+    static size_t hash(const Key &k) {
+        uint64_t x = ((uint64_t)k.from << 32 | k.fromPort) *
+                     0x9e3779b97f4a7c15ULL;
+        x ^= (uint64_t)k.to << 32 | k.toPort;
+        x ^= x >> 33;
+        x *= 0xff51afd7ed558ccdULL;
+        x ^= x >> 33;
+        return (size_t)x;
+    }
+
+    void grow() {
+        slots.assign(slots.empty() ? 16 : slots.size() * 2, npos);
+        size_t mask = slots.size() - 1;
+        for (uint32_t r = 0; r < records.size(); ++r) {
+            size_t i = hash(records[r].key) & mask;
+            while (slots[i] != npos)
+                i = (i + 1) & mask;
+            slots[i] = r;
         }
-        ss << "}" << std::endl;
-        viz.addSubGraph(print());
     }
 
-    virtual std::string print() const override { return ss.str(); }
+    uint32_t intern(StrRef s) {
+        scratch.assign(s.data(), s.size());
+        auto r = ids.emplace(scratch, (uint32_t)names.size());
+        if (r.second) names.push_back(scratch);
+        return r.first->second;
+    }
+
+    uint32_t symbol(StrRef s, const char *prefix) {
+        // `<prefix>N` without leading zeros and below 1e9
+        size_t n = s.size();
+        if (n > 5 && n < 15 && memcmp(s.data(), prefix, 5) == 0 &&
+            (s[5] != '0' || n == 6)) {
+            uint32_t v = 0;
+            size_t   i = 5;
+            for (; i < n && s[i] >= '0' && s[i] <= '9'; ++i)
+                v = v * 10 + (s[i] - '0');
+            if (i == n) return v << 1;
+        }
+        return intern(s) << 1 | 1;
+    }
+
+    void end(StrRef s, uint32_t &node, uint32_t &port) {
+        size_t colon = 0;
+        while (colon < s.size() && s[colon] != ':')
+            ++colon;
+        node = symbol(StrRef(s.data(), colon), "_node");
+        port = colon == s.size()
+                   ? npos
+                   : symbol(StrRef(s.data() + colon + 1, s.size() - colon - 1),
+                            "_port");
+    }
+
+    void appendSymbol(std::string &out, uint32_t sym, const char *prefix) const {
+        if (sym & 1) {
+            out += names[sym >> 1];
+            return;
+        }
+        char     digits[10];
+        int      n = 0;
+        uint32_t v = sym >> 1;
+        do {
+            digits[n++] = char('0' + v % 10);
+            v /= 10;
+        } while (v);
+        out.append(prefix, 5);
+        while (n)
+            out += digits[--n];
+    }
+
+    void appendEnd(std::string &out, uint32_t node, uint32_t port) const {
+        appendSymbol(out, node, "_node");
+        if (port == npos) return;
+        out += ':';
+        appendSymbol(out, port, "_port");
+    }
+
+    /**
+     * @brief The text of an end, as up to five pieces
+     */
+    struct Spelling {
+        StrRef part[5];
+        int    parts = 0;
+        char   digits[2][10];
+
+        Spelling(const EdgeStore &store, uint32_t node, uint32_t port) {
+            add(store, node, "_node", digits[0]);
+            if (port == npos) return;
+            part[parts++] = StrRef(":", 1);
+            add(store, port, "_port", digits[1]);
+        }
+
+        void add(const EdgeStore &store, uint32_t sym, const char *prefix,
+                 char *buf) {
+            if (sym & 1) {
+                part[parts++] = store.names[sym >> 1];
+                return;
+            }
+            int      n = 10;
+            uint32_t v = sym >> 1;
+            do {
+                buf[--n] = char('0' + v % 10);
+                v /= 10;
+            } while (v);
+            part[parts++] = StrRef(prefix, 5);
+            part[parts++] = StrRef(buf + n, 10 - n);
+        }
+
+        // compares like the concatenated strings
+        int compare(const Spelling &o) const {
+            int    i = 0, j = 0;
+            size_t x = 0, y = 0;
+            while (true) {
+                while (i < parts && x == part[i].size())
+                    ++i, x = 0;
+                while (j < o.parts && y == o.part[j].size())
+                    ++j, y = 0;
+                if (i == parts || j == o.parts)
+                    return (i == parts ? 0 : 1) - (j == o.parts ? 0 : 1);
+                size_t n = std::min(part[i].size() - x, o.part[j].size() - y);
+                int    c = memcmp(part[i].data() + x, o.part[j].data() + y, n);
+                if (c) return c;
+                x += n;
+                y += n;
+            }
+        }
+    };
+
+    bool less(const Key &a, const Key &b) const {
+        if (a.from != b.from || a.fromPort != b.fromPort) {
+            int c = Spelling(*this, a.from, a.fromPort)
+                        .compare(Spelling(*this, b.from, b.fromPort));
+            if (c) return c < 0;
+        }
+        return Spelling(*this, a.to, a.toPort)
+                   .compare(Spelling(*this, b.to, b.toPort)) < 0;
+    }
+
+    /**
+     * @brief The first 24 bytes of `from`, which order most edges alone
+     */
+    struct SortKey {
+        uint64_t prefix[3];
+        uint32_t record;
+    };
+
+    SortKey sortKey(uint32_t r) const {
+        const Key &k = records[r].key;
+        Spelling   s(*this, k.from, k.fromPort);
+        uint8_t    buf[24] = {};
+        size_t     n       = 0;
+        for (int i = 0; i < s.parts && n < 24; ++i) {
+            size_t m = std::min(s.part[i].size(), 24 - n);
+            memcpy(buf + n, s.part[i].data(), m);
+            n += m;
+        }
+        SortKey key;
+        for (int i = 0; i < 3; ++i) {
+            key.prefix[i] = 0;
+            for (int j = 0; j < 8; ++j)
+                key.prefix[i] = key.prefix[i] << 8 | buf[i * 8 + j];
+        }
+        key.record = r;
+        return key;
+    }
+
+    /**
+     * @brief Record indices sorted by `from` then `to`, as the names compare
+     * @details Kept until another edge is added, then only the new edges
+     *          are sorted and merged in.
+     */
+    const std::vector<uint32_t> &sortedOrder() const {
+        if (sorted.size() == records.size()) return sorted;
+        if (records.size() == 1) {
+            sorted.assign(1, 0);
+            return sorted;
+        }
+        auto before = [this](const SortKey &a, const SortKey &b) {
+            for (int i = 0; i < 3; ++i)
+                if (a.prefix[i] != b.prefix[i])
+                    return a.prefix[i] < b.prefix[i];
+            return less(records[a.record].key, records[b.record].key);
+        };
+        std::vector<SortKey> keys;
+        keys.reserve(records.size());
+        for (uint32_t r = (uint32_t)sorted.size(); r < records.size(); ++r)
+            keys.push_back(sortKey(r));
+        std::sort(keys.begin(), keys.end(), before);
+
+        size_t done = sorted.size();
+        sorted.reserve(records.size());
+        for (auto &k : keys)
+            sorted.push_back(k.record);
+        if (done)
+            std::inplace_merge(sorted.begin(), sorted.begin() + done,
+                               sorted.end(), [this](uint32_t x, uint32_t y) {
+                                   return less(records[x].key, records[y].key);
+                               });
+        return sorted;
+    }
+
+    std::vector<Record>   records;
+    std::vector<uint32_t> slots;
+
+    std::vector<std::string>                  names;
+    std::unordered_map<std::string, uint32_t> ids;
+    std::string                               scratch;
+
+    mutable std::vector<uint32_t> sorted;
+};
+
+/**
+ * @brief A closed subgraph, kept as a tree until the whole graph is printed
+ * @details The text of its own nodes and edges is rendered once when it is
+ *          closed; the subgraphs nested in it are kept as clusters too and
+ *          moved, not copied, into their parent.
+ */
+struct Cluster {
+    /**
+     * @brief A subgraph inside a graph, either a cluster or text
+     */
+    struct Child {
+        std::string              text;
+        std::unique_ptr<Cluster> cluster;
+
+        template <class W> void write(W &w) const {
+            if (cluster)
+                cluster->write(w);
+            else
+                w.write(text);
+        }
+        std::string str() const { return cluster ? cluster->str() : text; }
+    };
+
+    std::string        head;     // `subgraph ... {` and the graph style
+    std::vector<Child> children; // written between head and tail
+    std::string        tail;     // the nodes, the edges and `}`
+    size_t             bytes = 0; // the rendered size with the children
+
+    template <class W> void write(W &w) const {
+        w.write(head);
+        for (auto &child : children) {
+            child.write(w);
+            w.write("\n", 1);
+        }
+        w.write(tail);
+    }
+
+    std::string str() const {
+        struct {
+            std::string out;
+            void write(const char *s, size_t n) { out.append(s, n); }
+            void write(const std::string &s) { out += s; }
+        } w;
+        w.out.reserve(bytes);
+        write(w);
+        return std::move(w.out);
+    }
+};
+
+inline void IViz::addCluster(std::unique_ptr<Cluster> cluster) {
+    addSubGraph(cluster->str());
+}
+
+/**
+ * @brief A graph which only keeps the nodes its callbacks load
+ * @details The middle of a long chain is shown into it, see `IViz::elide`.
+ *          Table nodes send their rows to a `NullRecorder`, and edges and
+ *          names are dropped, except that a named node counts as shown so a
+ *          subgraph walk stops.
+ */
+class ChainCounter : public IViz {
+  public:
+    explicit ChainCounter(IViz &viz) : viz(viz) { walking = true; }
+
+    virtual std::string print() const override { return std::string(); }
+
+    virtual std::string genNodeName() override { return "_node"; }
+    virtual std::string genEdgeName() override { return "_edge"; }
+    virtual std::string genPortName() override { return "_port"; }
+
+    using IViz::addEdge;
+    virtual void addEdge(std::string, std::string, std::string) override {}
+    virtual void addEdge(std::string, void *, std::string) override {}
+    virtual void addNode(std::string, std::string) override {}
+    virtual void addSubGraph(std::string) override {}
+    virtual void addCluster(std::unique_ptr<Cluster>) override {}
+
+    virtual void setName(void *ds, std::string) override {
+        named.insert(ds, 0);
+    }
+    virtual std::string getName(void *) const override {
+        return std::string();
+    }
+    virtual void *getDS(std::string) const override { return nullptr; }
+    virtual bool  hasNode(void *ds) const override {
+        return named.find(ds) != PtrIndex::npos || viz.hasNode(ds);
+    }
+
+    virtual Recorder      *recorder() override { return &dropped; }
+    virtual const Summary &summary() const override { return viz.summary(); }
+
+  private:
+    IViz        &viz;
+    PtrIndex     named;
+    NullRecorder dropped;
+};
+
+inline bool IViz::elide(Pending p) {
+    ChainCounter counter(*this);
+    std::string  name;
+    size_t       n = 0;
+    while (true) {
+        counter.children.clear();
+        p.show(p.ds, counter);
+        if (counter.children.size() > 1) break;
+        if (n++ == 0) name = genNodeName();
+        setName(p.ds, name);
+        if (counter.children.empty()) break;
+        unsigned depth = p.depth;
+        p              = counter.children[0];
+        p.depth        = depth + 1;
+    }
+    if (n == 0) return false;
+    addNode(name, "[label=\"\xe2\x80\xa6 " + std::to_string(n) +
+                      " more\" shape=box style=dashed]");
+    if (counter.children.size() > 1) {
+        // the chain ends at a node which branches, shown as usual
+        p.chain = 0;
+        worklist.push_back(p);
+        addEdge(name, p.ds);
+    }
+    return true;
+}
+
+/**
+ * @brief A class representing a subgraph in graphviz dot file
+ * @param V The type of the parent viz, see `VizRef`
+ */
+template <class V> class BasicSubGraph : public IViz {
+  public:
+    BasicSubGraph(V &viz, std::string name = "", std::string label = "",
+                  Config config = {})
+        : viz(viz), order(config.edge_order), cluster(new Cluster) {
+        typed          = static_cast<IViz &>(viz).typed;
+        std::string &h = cluster->head;
+        h              = "subgraph cluster_" + name + " {\n";
+        if (!label.empty()) h += "label = \"" + label + "\";\n";
+        h += config.genGraphStyle();
+        h += "\n";
+    }
+    virtual ~BasicSubGraph() {
+        // targets that are still on the parent's worklist stay pending there
+        for (auto &w : waiting) {
+            if (hasNode(w.first))
+                addEdge(w.second.first, getName(w.first), w.second.second);
+            else
+                viz.addEdge(w.second.first, w.first, w.second.second);
+        }
+        close(cluster->tail);
+        cluster->bytes += cluster->head.size() + cluster->tail.size();
+        viz.addCluster(std::move(cluster));
+    }
+
+    virtual std::string print() const override {
+        std::string s = cluster->str();
+        close(s);
+        return s;
+    }
 
     virtual void setName(void *ds, std::string name) override {
         viz.setName(ds, name);
@@ -578,37 +2349,237 @@ class SubGraph : public IViz {
                          std::string edge = "") override {
         assert(!from.empty());
         assert(!to.empty());
-        edges[Edge(from, to)] = edge;
+        bytes += from.size() + to.size() + edge.size() + 7;
+        edges.add(from, to, edge);
     }
+
+    virtual void addEdge(std::string from, void *to,
+                         std::string edge = "") override {
+        if (hasNode(to))
+            addEdge(std::move(from), getName(to), std::move(edge));
+        else
+            waiting.push_back(std::make_pair(
+                to, std::make_pair(std::move(from), std::move(edge))));
+    }
+
     virtual void addNode(std::string name, std::string node) override {
         assert(!name.empty());
-        nodes[name] = node;
+        bytes += name.size() + node.size() + 3;
+        nodes[std::move(name)] = std::move(node);
     }
 
     virtual void addSubGraph(std::string subgraph) override {
-        subgraphs.push_back(subgraph);
+        cluster->bytes += subgraph.size() + 1;
+        cluster->children.push_back(Cluster::Child{std::move(subgraph), {}});
+    }
+    virtual void addCluster(std::unique_ptr<Cluster> sub) override {
+        cluster->bytes += sub->bytes + 1;
+        cluster->children.push_back(Cluster::Child{{}, std::move(sub)});
     }
     virtual bool hasNode(void *ds) const override { return viz.hasNode(ds); }
+    virtual bool claim(void *ds) override { return viz.claim(ds); }
+    virtual bool admit(unsigned depth) override { return viz.admit(depth); }
+    virtual const Summary &summary() const override { return viz.summary(); }
+    virtual Budget getBudget() const override { return viz.getBudget(); }
 
     virtual std::string genNodeName() override { return viz.genNodeName(); }
     virtual std::string genEdgeName() override { return viz.genEdgeName(); }
     virtual std::string genPortName() override { return viz.genPortName(); }
 
+  protected:
+    virtual void reached(void *ds, const std::type_info &type) override {
+        static_cast<IViz &>(viz.get()).reached(ds, type);
+    }
+
+#if DSVIZ_STATS
+    virtual void shownType(const std::type_info              &type,
+                           std::chrono::steady_clock::duration time) override {
+        static_cast<IViz &>(viz.get()).shownType(type, time);
+    }
+#endif
+
   private:
-    IViz             &viz;
-    std::stringstream ss;
+    // append the nodes, the edges and the closing brace
+    void close(std::string &s) const {
+        s.reserve(s.size() + bytes + 2);
+        for (auto &node : nodes) {
+            s += node.first;
+            s += ' ';
+            s += node.second;
+            s += ";\n";
+        }
+        edges.each(order, [&s](const std::string &from, const std::string &to,
+                               const std::string &attr) {
+            s += from;
+            s += " -> ";
+            s += to;
+            s += ' ';
+            s += attr;
+            s += ";\n";
+        });
+        s += "}\n";
+    }
+
+    VizRef<V>                viz;
+    EdgeOrder                order;
+    std::unique_ptr<Cluster> cluster;
 
     std::map<std::string, std::string> nodes;
-    std::map<Edge, std::string>        edges;
-    std::vector<std::string>           subgraphs;
+    EdgeStore                          edges;
+    size_t                             bytes = 0; // of nodes and edges
+
+    // edges whose target is not shown yet: (to, (from, edge attributes))
+    std::vector<std::pair<void *, std::pair<std::string, std::string>>>
+        waiting;
 };
 
+typedef BasicSubGraph<IViz> SubGraph;
+
 inline std::ostream &
 operator<<(std::ostream &out, const IViz &viz) {
-    out << viz.print() << std::endl;
+    viz.write(out);
+    out << std::endl;
     return out;
 }
 
+/**
+ * @brief The readable name of a type, demangled where the compiler allows
+ */
+inline std::string
+typeName(const std::type_info &type) {
+#ifdef __GNUC__
+    int   status;
+    char *name = abi::__cxa_demangle(type.name(), nullptr, nullptr, &status);
+    if (name) {
+        std::string s = name;
+        free(name);
+        return s;
+    }
+#endif
+    return type.name();
+}
+
+/**
+ * @brief Append `s` to `out` as a quoted JSON string
+ */
+inline void
+jsonQuote(std::string &out, StrRef s) {
+    out += '"';
+    for (size_t i = 0; i < s.size(); ++i) {
+        unsigned char c = s[i];
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += char(c);
+        } else if (c < 0x20) {
+            char esc[8];
+            snprintf(esc, sizeof esc, "\\u%04x", c);
+            out += esc;
+        } else {
+            out += char(c);
+        }
+    }
+    out += '"';
+}
+
+/**
+ * @brief Counters and timings collected by a `Dot`
+ * @details They are only collected if `DSVIZ_STATS` is defined to 1 before
+ *          including dsv.hpp. Otherwise the counting code is compiled out and
+ *          everything stays zero.
+ */
+struct Stats {
+    struct Type {
+        std::string name;
+        size_t      nodes   = 0;
+        double      seconds = 0; // in its dsviz_show
+    };
+
+    size_t nodes_visited      = 0; // dsviz_show calls
+    size_t duplicate_hits     = 0; // load_ds of nodes shown or queued already
+    size_t edges_added        = 0;
+    size_t edges_deduplicated = 0; // edges which replaced an earlier one
+    size_t bytes_encoded      = 0; // input of IViz::encode
+
+    double traversal = 0; // seconds in load_ds outside of dsviz_show
+    double labels    = 0; // seconds in dsviz_show, building the labels
+    double emission  = 0; // seconds in print
+
+    std::vector<Type> types; // Mock types in order of first use
+
+    /**
+     * @brief Print the stats as dot comments, to put at the end of a graph
+     */
+    std::string comment() const {
+        std::stringstream ss;
+        ss << "// dsviz stats: nodes_visited=" << nodes_visited
+           << " duplicate_hits=" << duplicate_hits
+           << " edges_added=" << edges_added
+           << " edges_deduplicated=" << edges_deduplicated
+           << " bytes_encoded=" << bytes_encoded << "\n";
+        ss << "// dsviz phases: traversal=" << traversal
+           << "s labels=" << labels << "s emission=" << emission << "s\n";
+        for (auto &t : types)
+            ss << "// dsviz type " << t.name << ": nodes=" << t.nodes
+               << " seconds=" << t.seconds << "\n";
+        return ss.str();
+    }
+
+    std::string json() const {
+        std::stringstream ss;
+        ss << "{\"nodes_visited\":" << nodes_visited
+           << ",\"duplicate_hits\":" << duplicate_hits
+           << ",\"edges_added\":" << edges_added
+           << ",\"edges_deduplicated\":" << edges_deduplicated
+           << ",\"bytes_encoded\":" << bytes_encoded
+           << ",\"traversal\":" << traversal << ",\"labels\":" << labels
+           << ",\"emission\":" << emission << ",\"types\":[";
+        for (size_t i = 0; i < types.size(); ++i) {
+            std::string name;
+            jsonQuote(name, types[i].name);
+            ss << (i ? "," : "") << "{\"name\":" << name
+               << ",\"nodes\":" << types[i].nodes
+               << ",\"seconds\":" << types[i].seconds << "}";
+        }
+        ss << "]}";
+        return ss.str();
+    }
+};
+
+/**
+ * @brief How much `Dot::compact` reduced a graph
+ */
+struct Compaction {
+    size_t nodes_before = 0, nodes_after = 0;
+    size_t edges_before = 0, edges_after = 0;
+    size_t groups       = 0; // nodes marked `×N`, each standing for N nodes
+
+    /**
+     * @brief Nodes before for each node after
+     */
+    double ratio() const {
+        return nodes_after ? double(nodes_before) / nodes_after : 1;
+    }
+
+    /**
+     * @brief Print the reduction as a dot comment
+     */
+    std::string comment() const {
+        std::stringstream ss;
+        ss << "// dsviz compaction: nodes=" << nodes_before << "->"
+           << nodes_after << " edges=" << edges_before << "->" << edges_after
+           << " groups=" << groups << " ratio=" << ratio() << "\n";
+        return ss.str();
+    }
+};
+
+/**
+ * @brief A rendered graph, as bytes which are not NUL terminated
+ */
+struct Output {
+    const char *data;
+    size_t      size;
+};
+
 /**
  * @brief A class representing the whole dot file in graphviz
  */
@@ -616,38 +2587,384 @@ class Dot : public IViz {
   public:
     Dot(Config config = {}) : config(config) {}
 
-    virtual std::string print() const override {
-        std::stringstream ss;
-        ss << "digraph structs {" << std::endl;
-        ss << config.genGraphStyle() << std::endl;
+    /**
+     * @brief Limit how much the following `load_ds` calls will load
+     */
+    void setBudget(Budget budget) { this->budget = budget; }
+    virtual Budget getBudget() const override { return budget; }
+
+    /**
+     * @brief Shorten the long rows and chains of the following `load_ds` calls
+     */
+    void    setSummary(Summary summary) { summaryConfig = summary; }
+    Summary getSummary() const { return summaryConfig; }
+
+    /**
+     * @brief Number of nodes shown and bytes added so far
+     */
+    size_t shownNodes() const { return shown; }
+    size_t addedBytes() const { return bytes; }
+
+    /**
+     * @brief The counters and timings so far, see `DSVIZ_STATS`
+     */
+    Stats stats() const {
+#if DSVIZ_STATS
+        Stats s          = collected;
+        s.nodes_visited  = walkStats.shows;
+        s.duplicate_hits = walkStats.duplicates;
+        s.labels = std::chrono::duration<double>(walkStats.showTime).count();
+        return s;
+#else
+        return Stats();
+#endif
+    }
+
+    /**
+     * @brief Merge identical subtrees into one node marked `×N`
+     * @details Two nodes are merged if their labels are the same once their
+     *          ports are numbered within the node, and their edges leave the
+     *          same ports with the same attributes for nodes which are merged
+     *          too. Nodes are compared bottom-up, so identical subtrees
+     *          collapse from the leaves, and the node left keeps the edges
+     *          from the parents of all of them. Nodes on a cycle and nodes
+     *          named in a subgraph are left alone. Edges added later are not
+     *          redirected, so call it after loading.
+     */
+    Compaction compact() {
+        const uint32_t npos = PtrIndex::npos;
+        Compaction     c;
+        c.nodes_before = nodes.size();
+        c.edges_before = edges.size();
+
+        struct CNode {
+            std::map<std::string, std::string> ports; // to local
+            uint32_t                           label, cls;
+            uint8_t                            state = 0;
+        };
+        Graph                                     g = graph();
+        const std::vector<Graph::Link>           &es = g.edges;
+        std::vector<CNode>                        cn(g.nodes.size());
+        std::unordered_map<std::string, uint32_t> strings;
+        auto intern = [&strings](const std::string &s) {
+            return strings.emplace(s, (uint32_t)strings.size()).first->second;
+        };
+        for (uint32_t i = 0; i < cn.size(); ++i)
+            cn[i].label =
+                intern(localPorts(g.nodes[i].node->second, cn[i].ports));
+
+        // a port by its local name when the node has it
+        auto portId = [&](const std::string &end, size_t colon, uint32_t node) {
+            if (colon == std::string::npos) return npos;
+            std::string port = end.substr(colon + 1);
+            if (node != npos) {
+                auto it = cn[node].ports.find(port);
+                if (it != cn[node].ports.end()) return intern("\x1f" + it->second);
+            }
+            return intern(port);
+        };
+
+        // give each node a class once all its children have one
+        struct SigHash {
+            size_t operator()(const std::vector<uint32_t> &v) const {
+                uint64_t h = 0xcbf29ce484222325ULL;
+                for (uint32_t x : v)
+                    h = (h ^ x) * 0x100000001b3ULL;
+                return (size_t)h;
+            }
+        };
+        std::unordered_map<std::vector<uint32_t>, uint32_t, SigHash> classes;
+        std::vector<uint32_t>                        count, rep, pos(cn.size());
+        std::vector<std::pair<uint32_t, size_t>>     stack;
+        std::vector<std::array<uint32_t, 5>>         outs;
+        for (uint32_t root = 0; root < cn.size(); ++root) {
+            if (cn[root].state) continue;
+            cn[root].state = 1;
+            stack.push_back(std::make_pair(root, 0));
+            while (!stack.empty()) {
+                uint32_t i = stack.back().first;
+                if (stack.back().second < g.nodes[i].out.size()) {
+                    uint32_t d = es[g.nodes[i].out[stack.back().second++]].dst;
+                    if (d == npos || cn[d].state == 2) continue;
+                    if (cn[d].state == 1) {
+                        for (size_t s = pos[d]; s < stack.size(); ++s)
+                            g.nodes[stack[s].first].keep = true;
+                        continue;
+                    }
+                    cn[d].state = 1;
+                    pos[d]      = (uint32_t)stack.size();
+                    stack.push_back(std::make_pair(d, 0));
+                    continue;
+                }
+                stack.pop_back();
+                cn[i].state = 2;
 
-        for (auto subgraph : subgraphs) {
-            ss << subgraph << std::endl;
+                std::vector<uint32_t> sig;
+                if (g.nodes[i].keep) {
+                    sig.push_back(npos); // a class of its own
+                    sig.push_back(i);
+                } else {
+                    outs.clear();
+                    for (uint32_t k : g.nodes[i].out) {
+                        const Graph::Link &e = es[k];
+                        std::array<uint32_t, 5> o = {
+                            {portId(e.from, e.fromColon, i), intern(e.attr),
+                             portId(e.to, e.toColon, e.dst), 0, 0}};
+                        if (e.dst == npos)
+                            o[4] = intern(e.to.substr(0, e.toColon));
+                        else
+                            o[3] = 1, o[4] = cn[e.dst].cls;
+                        outs.push_back(o);
+                    }
+                    std::sort(outs.begin(), outs.end());
+                    sig.push_back(cn[i].label);
+                    for (auto &o : outs)
+                        sig.insert(sig.end(), o.begin(), o.end());
+                }
+                auto r = classes.emplace(std::move(sig), (uint32_t)count.size());
+                if (r.second) {
+                    count.push_back(0);
+                    rep.push_back(i);
+                }
+                cn[i].cls = r.first->second;
+                ++count[cn[i].cls];
+                rep[cn[i].cls] = std::min(rep[cn[i].cls], i);
+            }
         }
-        for (auto node : nodes) {
-            ss << node.first << " " << node.second << ";" << std::endl;
+
+        // the port of `r` with the same local name as `port` of `d`
+        auto samePort = [&](const std::string &port, uint32_t d, uint32_t r) {
+            auto it = cn[d].ports.find(port);
+            if (it == cn[d].ports.end()) return port;
+            for (auto &p : cn[r].ports)
+                if (p.second == it->second) return p.first;
+            return port;
+        };
+        EdgeStore kept;
+        for (auto &e : es) {
+            if (e.src != npos && rep[cn[e.src].cls] != e.src) continue;
+            if (e.dst == npos || rep[cn[e.dst].cls] == e.dst) {
+                kept.add(e.from, e.to, e.attr);
+                continue;
+            }
+            uint32_t    r  = rep[cn[e.dst].cls];
+            std::string to = g.nodes[r].node->first;
+            if (e.toColon != std::string::npos) {
+                to += ':';
+                to += samePort(e.to.substr(e.toColon + 1), e.dst, r);
+            }
+            kept.add(e.from, to, e.attr);
         }
-        for (auto edge : edges) {
-            ss << edge.first.from << " -> " << edge.first.to << " "
-               << edge.second << ";" << std::endl;
+        edges = std::move(kept);
+
+        for (uint32_t i = 0; i < cn.size(); ++i) {
+            uint32_t k = cn[i].cls;
+            if (rep[k] != i) {
+                nodes.erase(g.nodes[i].node);
+            } else if (count[k] > 1) {
+                std::string &body = g.nodes[i].node->second;
+                size_t       end  = body.rfind(']');
+                if (end != std::string::npos)
+                    body.insert(end, " xlabel=\"\xc3\x97" +
+                                         std::to_string(count[k]) + "\"");
+                ++c.groups;
+            }
         }
-        ss << "}" << std::endl;
-        return ss.str();
+        fresh         = false;
+        c.nodes_after = nodes.size();
+        c.edges_after = edges.size();
+        return c;
+    }
+
+    virtual const Summary &summary() const override { return summaryConfig; }
+
+    virtual bool admit(unsigned depth) override {
+        if (depth > budget.max_depth) return false;
+        if (shown >= budget.max_nodes || bytes >= budget.max_bytes)
+            return false;
+        if (budget.time_limit != std::chrono::steady_clock::duration::max() &&
+            std::chrono::steady_clock::now() - started > budget.time_limit)
+            return false;
+        ++shown;
+        return true;
+    }
+
+    /**
+     * @brief Render the graph
+     * @details The result is kept until the graph changes, and printing the
+     *          same graph again only copies it. The other print functions and
+     *          `write` use it when it is up to date. Printing is therefore not
+     *          safe from several threads at once.
+     */
+    virtual std::string print() const override {
+        if (!fresh) {
+            StringWriter w;
+            rendered.clear();
+            w.out = &rendered;
+            render(w);
+            fresh = true;
+        }
+        return rendered;
+    }
+
+    /**
+     * @brief Receives the rendered graph piece by piece
+     */
+    struct Writer {
+        virtual void write(const char *s, size_t n) = 0;
+        void         write(const std::string &s) { write(s.data(), s.size()); }
+    };
+
+    /**
+     * @brief Write the graph to a stream without building a string first
+     */
+    virtual void write(std::ostream &out) const override {
+        struct : Writer {
+            std::ostream *out;
+            void          write(const char *s, size_t n) override {
+                out->write(s, (std::streamsize)n);
+            }
+        } w;
+        w.out = &out;
+        print(w);
+    }
+
+    /**
+     * @brief Render the graph into the caller's buffer
+     * @details Like snprintf, at most `size - 1` bytes and a terminating NUL
+     *          are written.
+     * @return The length of the whole graph, which is larger than or equal
+     *         to `size` if it was cut
+     */
+    size_t print(char *buf, size_t size) const {
+        struct : Writer {
+            char  *buf;
+            size_t size, len = 0;
+            void   write(const char *s, size_t n) override {
+                if (len < size) memcpy(buf + len, s, std::min(n, size - len));
+                len += n;
+            }
+        } w;
+        w.buf  = buf;
+        w.size = size ? size - 1 : 0;
+        print(w);
+        if (size) buf[std::min(w.len, size - 1)] = '\0';
+        return w.len;
+    }
+
+    /**
+     * @brief Render the graph into a reusable buffer
+     * @details The buffer is replaced but keeps its capacity, so rendering
+     *          into the same buffer again does not allocate.
+     * @return The rendered bytes, valid until the buffer is changed
+     */
+    Output print(std::string &buf) const {
+        StringWriter w;
+        buf.clear();
+        w.out = &buf;
+        print(w);
+        return Output{buf.data(), buf.size()};
+    }
+
+    /**
+     * @brief Render the graph into a writer
+     */
+    virtual void print(Writer &w) const {
+        if (fresh)
+            w.write(rendered);
+        else
+            render(w);
     }
 
+  private:
+    struct StringWriter : Writer {
+        std::string *out;
+        void write(const char *s, size_t n) override { out->append(s, n); }
+    };
+
+    void render(Writer &w) const {
+#if DSVIZ_STATS
+        auto start = std::chrono::steady_clock::now();
+#endif
+        static const char begin[] = "digraph structs {\n";
+        w.write(begin, sizeof begin - 1);
+        w.write(config.genGraphStyle());
+        w.write("\n", 1);
+
+        for (auto &subgraph : subgraphs) {
+            subgraph.write(w);
+            w.write("\n", 1);
+        }
+        for (auto &node : nodes) {
+            w.write(node.first);
+            w.write(" ", 1);
+            w.write(node.second);
+            w.write(";\n", 2);
+        }
+        edges.each(config.edge_order,
+                   [&w](const std::string &from, const std::string &to,
+                        const std::string &attr) {
+                       w.write(from);
+                       w.write(" -> ", 4);
+                       w.write(to);
+                       w.write(" ", 1);
+                       w.write(attr);
+                       w.write(";\n", 2);
+                   });
+        w.write("}\n", 2);
+#if DSVIZ_STATS
+        collected.emission += std::chrono::duration<double>(
+                                  std::chrono::steady_clock::now() - start)
+                                  .count();
+#endif
+    }
+
+  public:
     virtual void setName(void *ds, std::string name) override {
-        names[ds] = name;
-        if (!name.empty()) DSs[name] = ds;
+        fresh = false;
+
+        uint32_t   id = entryOf(ds);
+        NodeEntry &e  = entries[id];
+        uint32_t   n;
+        if (parseNodeName(name, n)) {
+            e.kind = Numbered;
+            e.name = n;
+            if (byNumber.size() <= n) byNumber.resize(n + 1, PtrIndex::npos);
+            byNumber[n] = id;
+        } else {
+            e.kind = Custom;
+            e.name = (uint32_t)customNames.size();
+            customNames.push_back(name);
+            if (!name.empty()) byCustomName[name] = id;
+        }
+
+        uint32_t w = e.waiting;
+        e.waiting  = PtrIndex::npos;
+        while (w != PtrIndex::npos) {
+            WaitingEdge &we = waitingEdges[w];
+            addEdge(std::move(we.from), name, std::move(we.edge));
+            uint32_t next = we.next;
+            we.next       = freeWaiting;
+            freeWaiting   = w;
+            w             = next;
+        }
     }
 
     virtual std::string getName(void *ds) const override {
         assert(hasNode(ds));
-        return names.find(ds)->second;
+        return nameOf(entries[index.find(ds)]);
     }
 
     virtual void *getDS(std::string name) const override {
         assert(!name.empty());
-        return DSs.find(name)->second;
+        uint32_t n, id = PtrIndex::npos;
+        if (parseNodeName(name, n)) {
+            if (n < byNumber.size()) id = byNumber[n];
+        } else {
+            auto it = byCustomName.find(name);
+            if (it != byCustomName.end()) id = it->second;
+        }
+        return id == PtrIndex::npos ? nullptr : entries[id].ds;
     }
 
     using IViz::addEdge;
@@ -656,21 +2973,75 @@ class Dot : public IViz {
                          std::string edge = "") override {
         assert(!from.empty());
         assert(!to.empty());
-        edges[Edge(from, to)] = edge;
+        fresh = false;
+        bytes += from.size() + to.size() + edge.size() + 7;
+#if DSVIZ_STATS
+        ++collected.edges_added;
+        if (!edges.add(from, to, edge)) ++collected.edges_deduplicated;
+#else
+        edges.add(from, to, edge);
+#endif
+    }
+
+    /**
+     * @brief Add an edge to a node which may not be shown yet
+     * @details If `to` is still on the worklist, the edge is kept until
+     *          `setName` gives it a name.
+     */
+    virtual void addEdge(std::string from, void *to,
+                         std::string edge = "") override {
+        uint32_t id = index.find(to);
+        if (id != PtrIndex::npos && entries[id].kind != Unnamed) {
+            addEdge(std::move(from), nameOf(entries[id]), std::move(edge));
+            return;
+        }
+        uint32_t w;
+        if (freeWaiting != PtrIndex::npos) {
+            w           = freeWaiting;
+            freeWaiting = waitingEdges[w].next;
+        } else {
+            w = (uint32_t)waitingEdges.size();
+            waitingEdges.push_back(WaitingEdge());
+        }
+        NodeEntry   &e  = entries[entryOf(to)];
+        WaitingEdge &we = waitingEdges[w];
+        we.from         = std::move(from);
+        we.edge         = std::move(edge);
+        we.next         = e.waiting;
+        e.waiting       = w;
     }
 
     virtual void addNode(std::string name, std::string node) override {
         assert(!name.empty());
-        nodes[name] = node;
+        fresh = false;
+        bytes += name.size() + node.size() + 3;
+        nodes[std::move(name)] = std::move(node);
     }
 
     virtual void addSubGraph(std::string subgraph) override {
-        subgraphs.push_back(subgraph);
+        fresh = false;
+        bytes += subgraph.size() + 1;
+        subgraphs.push_back(Cluster::Child{std::move(subgraph), {}});
+    }
+
+    virtual void addCluster(std::unique_ptr<Cluster> cluster) override {
+        fresh = false;
+        bytes += cluster->bytes + 1;
+        subgraphs.push_back(Cluster::Child{{}, std::move(cluster)});
     }
 
     virtual bool hasNode(void *ds) const override {
         assert(ds);
-        return (names.find(ds) != names.end());
+        uint32_t id = index.find(ds);
+        return id != PtrIndex::npos && entries[id].kind != Unnamed;
+    }
+
+    // remembers the node, so that `finishWalk` stubs it if it is not shown
+    virtual bool claim(void *ds) override {
+        uint32_t id = entryOf(ds);
+        if (entries[id].kind != Unnamed) return false;
+        entries[id].reached = true;
+        return true;
     }
 
     virtual std::string genNodeName() override {
@@ -684,15 +3055,3384 @@ class Dot : public IViz {
     }
 
   protected:
-    int count0 = 0, count1 = 0, count2 = 0;
+    virtual void startWalk() override {
+        started = std::chrono::steady_clock::now();
+#if DSVIZ_STATS
+        startShowTime = walkStats.showTime;
+        startEncoded  = encodedBytes();
+#endif
+    }
 
-    std::map<std::string, std::string> nodes;
-    std::map<void *, std::string>      names;
-    std::map<std::string, void *>      DSs;
-    std::map<Edge, std::string>        edges;
-    std::vector<std::string>           subgraphs;
-    Config                             config;
-    friend class Node;
+    /**
+     * @brief Replace the nodes which the walk reached but did not show by
+     *        stub nodes
+     * @details Each node with edges to such nodes gets a stub `… N more`,
+     *          and those edges are redirected to the stub. Edges to nodes the
+     *          walk never reached keep waiting for them to be named.
+     */
+    virtual void finishWalk() override {
+#if DSVIZ_STATS
+        auto walk = std::chrono::steady_clock::now() - started;
+        collected.traversal += std::chrono::duration<double>(
+                                   walk - (walkStats.showTime - startShowTime))
+                                   .count();
+        collected.bytes_encoded += encodedBytes() - startEncoded;
+#endif
+        std::map<std::string, std::vector<uint32_t>> stubs; // node -> edges
+        std::map<std::string, size_t>                count;
+        for (auto &e : entries) {
+            if (e.kind != Unnamed || !e.reached || e.waiting == PtrIndex::npos)
+                continue;
+            std::set<std::string> sources; // count each target once per node
+            for (uint32_t w = e.waiting; w != PtrIndex::npos;
+                 w          = waitingEdges[w].next) {
+                const std::string &from = waitingEdges[w].from;
+                std::string        node = from.substr(0, from.find(':'));
+                if (sources.insert(node).second) ++count[node];
+                stubs[node].push_back(w);
+            }
+            e.waiting = PtrIndex::npos;
+        }
+        for (auto &s : stubs) {
+            std::string stub = genNodeName();
+            addNode(stub, "[label=\"\xe2\x80\xa6 " +
+                              std::to_string(count[s.first]) +
+                              " more\" shape=box style=dashed]");
+            for (auto w : s.second) {
+                WaitingEdge &we = waitingEdges[w];
+                addEdge(std::move(we.from), stub, std::move(we.edge));
+                we.next     = freeWaiting;
+                freeWaiting = w;
+            }
+        }
+    }
+
+    /**
+     * @brief The nodes of a `Dot` with the edges between them, numbered
+     */
+    struct Graph {
+        struct Node {
+            std::map<std::string, std::string>::iterator node;
+            std::vector<uint32_t>                        out; // edge ids
+            uint32_t                                     in = 0;
+            bool keep = false; // named in a subgraph
+        };
+        struct Link {
+            std::string from, to, attr;
+            uint32_t    src, dst; // node ids, or npos if not in `nodes`
+            size_t      fromColon, toColon;
+        };
+        std::vector<Node>                         nodes;
+        std::vector<Link>                         edges; // in insertion order
+        std::unordered_map<std::string, uint32_t> ids;
+    };
+
+    Graph graph() {
+        const uint32_t npos = PtrIndex::npos;
+        Graph          g;
+        g.nodes.resize(nodes.size());
+        uint32_t n = 0;
+        for (auto it = nodes.begin(); it != nodes.end(); ++it, ++n) {
+            g.ids.emplace(it->first, n);
+            g.nodes[n].node = it;
+        }
+        for (auto &sg : subgraphs) {
+            std::string text = sg.str();
+            for (size_t i = 0, j; i < text.size(); i = j + 1) {
+                for (j = i; j < text.size() &&
+                            (isalnum((unsigned char)text[j]) || text[j] == '_');
+                     ++j) {}
+                auto it = g.ids.find(text.substr(i, j - i));
+                if (it != g.ids.end()) g.nodes[it->second].keep = true;
+            }
+        }
+
+        g.edges.reserve(edges.size());
+        auto nodeOf = [&g, npos](const std::string &end, size_t &colon) {
+            colon   = end.find(':');
+            auto it = g.ids.find(end.substr(0, colon));
+            return it == g.ids.end() ? npos : it->second;
+        };
+        edges.each(EdgeOrder::Inserted,
+                   [&](const std::string &from, const std::string &to,
+                       const std::string &attr) {
+                       Graph::Link e{from, to, attr, 0, 0, 0, 0};
+                       e.src = nodeOf(from, e.fromColon);
+                       e.dst = nodeOf(to, e.toColon);
+                       if (e.src != npos)
+                           g.nodes[e.src].out.push_back(
+                               (uint32_t)g.edges.size());
+                       if (e.dst != npos) ++g.nodes[e.dst].in;
+                       g.edges.push_back(std::move(e));
+                   });
+        return g;
+    }
+
+    // renames PORT='x' to PORT='pN' in order of appearance
+    static std::string localPorts(const std::string              &body,
+                                  std::map<std::string, std::string> &ports) {
+        static const std::string key = "PORT='";
+        std::string              out;
+        size_t                   i = 0, j;
+        while ((j = body.find(key, i)) != std::string::npos) {
+            size_t end = body.find('\'', j + key.size());
+            if (end == std::string::npos) break;
+            size_t      begin = j + key.size();
+            std::string port  = body.substr(begin, end - begin);
+            std::string local = "p" + std::to_string(ports.size());
+            ports.insert(std::make_pair(port, local));
+            out.append(body, i, j + key.size() - i);
+            out += ports[port];
+            i = end;
+        }
+        out.append(body, i, std::string::npos);
+        return out;
+    }
+
+    enum NameKind : uint8_t { Unnamed, Numbered, Custom };
+
+    /**
+     * @brief Everything known about one pointer, indexed by its node id
+     * @details A `_nodeN` name is stored as the number N and only formatted
+     *          when it is asked for; other names are kept in `customNames`.
+     */
+    struct NodeEntry {
+        void    *ds;
+        uint32_t name;    // N of `_nodeN`, or an index into `customNames`
+        uint32_t waiting; // first edge waiting for this node to be named
+        NameKind kind;
+        bool     reached; // claimed by a walk, see `claim`
+    };
+
+    /**
+     * @brief An edge whose target is still on the worklist
+     */
+    struct WaitingEdge {
+        std::string from, edge;
+        uint32_t    next;
+    };
+
+    /**
+     * @brief Get the node id of a pointer, adding an unnamed entry if needed
+     */
+    uint32_t entryOf(void *ds) {
+        uint32_t id = index.insert(ds, (uint32_t)entries.size());
+        if (id == entries.size()) {
+            NodeEntry e = {ds, 0, PtrIndex::npos, Unnamed, false};
+            entries.push_back(e);
+        }
+        return id;
+    }
+
+    std::string nameOf(const NodeEntry &e) const {
+        if (e.kind == Numbered) return "_node" + std::to_string(e.name);
+        return customNames[e.name];
+    }
+
+    /**
+     * @brief Parse a name generated by `genNodeName`
+     * @return True if the name is exactly `_nodeN`
+     */
+    static bool parseNodeName(const std::string &name, uint32_t &n) {
+        if (name.size() < 6 || name.size() > 15) return false;
+        if (name.compare(0, 5, "_node") != 0) return false;
+        if (name[5] == '0' && name.size() != 6) return false;
+        uint64_t v = 0;
+        for (size_t i = 5; i < name.size(); ++i) {
+            if (name[i] < '0' || name[i] > '9') return false;
+            v = v * 10 + (name[i] - '0');
+        }
+        if (v >= PtrIndex::npos) return false;
+        n = (uint32_t)v;
+        return true;
+    }
+
+    int count0 = 0, count1 = 0, count2 = 0;
+
+    std::map<std::string, std::string> nodes;
+    EdgeStore                          edges;
+    std::vector<Cluster::Child>        subgraphs;
+    Config                             config;
+
+    mutable std::string rendered; // the last print(), if fresh
+    mutable bool        fresh = false;
+
+    PtrIndex                        index;
+    std::vector<NodeEntry>          entries;
+    std::vector<uint32_t>           byNumber;
+    std::vector<std::string>        customNames;
+    std::map<std::string, uint32_t> byCustomName;
+    std::vector<WaitingEdge>        waitingEdges;
+    uint32_t                        freeWaiting = PtrIndex::npos;
+
+    Budget                                budget;
+    Summary                               summaryConfig;
+    size_t                                shown = 0, bytes = 0;
+    std::chrono::steady_clock::time_point started;
+
+#if DSVIZ_STATS
+    virtual void shownType(const std::type_info              &type,
+                           std::chrono::steady_clock::duration time) override {
+        auto r = typeStats.emplace(std::type_index(type),
+                                   collected.types.size());
+        if (r.second) {
+            collected.types.push_back(Stats::Type());
+            collected.types.back().name = typeName(type);
+        }
+        Stats::Type &t = collected.types[r.first->second];
+        ++t.nodes;
+        t.seconds += std::chrono::duration<double>(time).count();
+    }
+
+    mutable Stats                       collected;
+    std::map<std::type_index, size_t>   typeStats;
+    std::chrono::steady_clock::duration startShowTime{};
+    size_t                              startEncoded = 0;
+#endif
+    template <class V> friend class BasicNode;
+    friend class Snapshot;
+};
+
+/**
+ * @brief A capture of a `Dot` which can be compared with a later capture
+ * @details Nodes are keyed by the pointer they show, and named `_n<address>`,
+ *          so a node keeps its name between captures. For a `Mock` that is
+ *          the mock object, so the captures must take their mock objects
+ *          from the same `MockScope`. Port names are numbered
+ *          within each node (`p0`, `p1`, ...) so a node does not change when
+ *          unrelated nodes are added. Only a 64-bit hash of each node is
+ *          compared; the text is kept to rebuild the dot file.
+ */
+class Snapshot {
+  public:
+    /**
+     * @brief An edge between two stable names, with its attributes
+     */
+    struct SnapEdge {
+        std::string from, to, attr;
+    };
+
+    /**
+     * @brief The difference between two snapshots
+     */
+    struct Delta {
+        std::vector<std::pair<std::string, std::string>> added_nodes;
+        std::vector<std::pair<std::string, std::string>> changed_nodes;
+        std::vector<std::string>                         removed_nodes;
+        std::vector<SnapEdge>                            added_edges;
+        std::vector<SnapEdge>                            removed_edges;
+        bool                     subgraphs_changed = false;
+        std::vector<std::string> subgraphs;
+
+        bool empty() const {
+            return added_nodes.empty() && changed_nodes.empty() &&
+                   removed_nodes.empty() && added_edges.empty() &&
+                   removed_edges.empty() && !subgraphs_changed;
+        }
+
+        /**
+         * @brief Print the delta, one change per line
+         * @details Lines start with `+` (added), `~` (changed) or `-`
+         *          (removed), followed by a dot statement. Subgraphs are
+         *          replaced as a whole and start with `=`.
+         */
+        std::string print() const {
+            std::stringstream ss;
+            for (auto &n : added_nodes)
+                ss << "+ " << n.first << " " << n.second << ";\n";
+            for (auto &n : changed_nodes)
+                ss << "~ " << n.first << " " << n.second << ";\n";
+            for (auto &n : removed_nodes)
+                ss << "- " << n << ";\n";
+            for (auto &e : added_edges)
+                ss << "+ " << e.from << " -> " << e.to << " " << e.attr
+                   << ";\n";
+            for (auto &e : removed_edges)
+                ss << "- " << e.from << " -> " << e.to << ";\n";
+            if (subgraphs_changed)
+                for (auto &sg : subgraphs)
+                    ss << "= " << sg << "\n";
+            return ss.str();
+        }
+    };
+
+    /**
+     * @brief The key a node is known by between captures, or "" to use its
+     *        pointer
+     */
+    typedef std::function<std::string(const void *ds)> Key;
+
+    Snapshot() {}
+
+    /**
+     * @brief Capture the current content of a dot file
+     * @param key Names the nodes by a key of the caller, such as a record id,
+     *            instead of their address. The node shown for a pointer is
+     *            named `_k<key>`, with the characters other than letters and
+     *            digits written as `_XX` in hex.
+     */
+    explicit Snapshot(const Dot &dot, const Key &key = nullptr)
+        : style(dot.config.genGraphStyle()) {
+        // stable names of the nodes which are known by their pointer
+        std::map<std::string, std::string> stable;
+        for (auto &e : dot.entries) {
+            if (e.kind == Dot::Unnamed) continue;
+            std::string name = e.kind == Dot::Numbered
+                                   ? "_node" + std::to_string(e.name)
+                                   : dot.customNames[e.name];
+            std::string k = key ? key(e.ds) : std::string();
+            if (!k.empty()) {
+                stable[name] = keyName(k);
+                continue;
+            }
+            char buf[32];
+            snprintf(buf, sizeof(buf), "_n%llx",
+                     (unsigned long long)(uintptr_t)e.ds);
+            stable[name] = buf;
+        }
+
+        std::map<std::string, std::map<std::string, std::string>> ports;
+        for (auto &n : dot.nodes) {
+            auto        it = stable.find(n.first);
+            std::string id = it == stable.end() ? n.first : it->second;
+            SnapNode   &sn = nodes[id];
+            sn.body        = Dot::localPorts(n.second, ports[n.first]);
+            sn.hash        = hash(sn.body);
+        }
+        dot.edges.each(EdgeOrder::Inserted,
+                       [&](const std::string &from, const std::string &to,
+                           const std::string &attr) {
+                           edges[std::make_pair(endpoint(from, stable, ports),
+                                                endpoint(to, stable, ports))] =
+                               attr;
+                       });
+        for (auto &sg : dot.subgraphs)
+            subgraphs.push_back(sg.str());
+    }
+
+    /**
+     * @brief Compute the changes which turn this snapshot into `next`
+     */
+    Delta diff(const Snapshot &next) const {
+        Delta d;
+        auto  a = nodes.begin(), b = next.nodes.begin();
+        while (a != nodes.end() || b != next.nodes.end()) {
+            if (b == next.nodes.end() ||
+                (a != nodes.end() && a->first < b->first)) {
+                d.removed_nodes.push_back(a->first);
+                ++a;
+            } else if (a == nodes.end() || b->first < a->first) {
+                d.added_nodes.push_back(
+                    std::make_pair(b->first, b->second.body));
+                ++b;
+            } else {
+                if (a->second.hash != b->second.hash)
+                    d.changed_nodes.push_back(
+                        std::make_pair(b->first, b->second.body));
+                ++a, ++b;
+            }
+        }
+
+        auto x = edges.begin(), y = next.edges.begin();
+        while (x != edges.end() || y != next.edges.end()) {
+            if (y == next.edges.end() ||
+                (x != edges.end() && x->first < y->first)) {
+                d.removed_edges.push_back(toEdge(*x));
+                ++x;
+            } else if (x == edges.end() || y->first < x->first) {
+                d.added_edges.push_back(toEdge(*y));
+                ++y;
+            } else {
+                if (x->second != y->second) {
+                    d.removed_edges.push_back(toEdge(*x));
+                    d.added_edges.push_back(toEdge(*y));
+                }
+                ++x, ++y;
+            }
+        }
+
+        if (subgraphs != next.subgraphs) {
+            d.subgraphs_changed = true;
+            d.subgraphs         = next.subgraphs;
+        }
+        return d;
+    }
+
+    /**
+     * @brief Apply the changes computed by `diff`
+     */
+    void apply(const Delta &d) {
+        for (auto &n : d.removed_nodes)
+            nodes.erase(n);
+        for (auto &e : d.removed_edges)
+            edges.erase(std::make_pair(e.from, e.to));
+        for (auto &n : d.added_nodes)
+            nodes[n.first] = SnapNode{n.second, hash(n.second)};
+        for (auto &n : d.changed_nodes)
+            nodes[n.first] = SnapNode{n.second, hash(n.second)};
+        for (auto &e : d.added_edges)
+            edges[std::make_pair(e.from, e.to)] = e.attr;
+        if (d.subgraphs_changed) subgraphs = d.subgraphs;
+    }
+
+    /**
+     * @brief Print the whole dot file of this snapshot
+     */
+    std::string print() const { return render(nullptr); }
+
+    size_t size() const { return nodes.size(); }
+
+  private:
+    friend class LayoutCache;
+
+    // with the positions of `layout` pinned, if given
+    std::string print(const LayoutCache *layout) const;
+
+    // each node body is passed to `node` before it is written
+    std::string render(
+        const std::function<void(const std::string &, std::string &)> &node)
+        const {
+        std::stringstream ss;
+        std::string       body;
+        ss << "digraph structs {" << std::endl;
+        ss << style << std::endl;
+        for (auto &sg : subgraphs)
+            ss << sg << std::endl;
+        for (auto &n : nodes) {
+            body = n.second.body;
+            if (node) node(n.first, body);
+            ss << n.first << " " << body << ";" << std::endl;
+        }
+        for (auto &e : edges)
+            ss << e.first.first << " -> " << e.first.second << " "
+               << e.second << ";" << std::endl;
+        ss << "}" << std::endl;
+        return ss.str();
+    }
+
+    static std::string keyName(const std::string &key) {
+        static const char hex[] = "0123456789abcdef";
+        std::string       name  = "_k";
+        for (unsigned char c : key) {
+            if (isalnum(c)) {
+                name += char(c);
+            } else {
+                name += '_';
+                name += hex[c >> 4];
+                name += hex[c & 15];
+            }
+        }
+        return name;
+    }
+
+    struct SnapNode {
+        std::string body;
+        uint64_t    hash;
+    };
+
+    static uint64_t hash(const std::string &s) {
+        uint64_t h = 0xcbf29ce484222325ULL; // FNV-1a
+        for (unsigned char c : s) {
+            h ^= c;
+            h *= 0x100000001b3ULL;
+        }
+        return h;
+    }
+
+    static std::string
+    endpoint(const std::string                        &name,
+             const std::map<std::string, std::string> &stable,
+             std::map<std::string, std::map<std::string, std::string>> &ports) {
+        size_t      colon = name.find(':');
+        std::string node  = name.substr(0, colon);
+        auto        it    = stable.find(node);
+        std::string id    = it == stable.end() ? node : it->second;
+        if (colon == std::string::npos) return id;
+        std::string port = name.substr(colon + 1);
+        auto       &map  = ports[node];
+        auto        p    = map.find(port);
+        return id + ":" + (p == map.end() ? port : p->second);
+    }
+
+    static SnapEdge
+    toEdge(const std::pair<const std::pair<std::string, std::string>,
+                           std::string> &e) {
+        return SnapEdge{e.first.first, e.first.second, e.second};
+    }
+
+    std::string                     style;
+    std::map<std::string, SnapNode> nodes;
+    std::map<std::pair<std::string, std::string>, std::string> edges;
+    std::vector<std::string> subgraphs;
+};
+
+/**
+ * @brief The positions graphviz gave the nodes of a snapshot
+ * @details Load the layout of one snapshot, and the next snapshot is printed
+ *          with `pos="x,y!"` on every node which has not changed since, so
+ *          it keeps its place. Render that with `neato -n2` if `pinned()`
+ *          equals the number of nodes, and with `neato -s` otherwise, which
+ *          only places the other nodes.
+ */
+class LayoutCache {
+  public:
+    /**
+     * @brief Read the positions from a graphviz layout of `snap`
+     * @param layout The output of `-Tplain`, `-Tdot` or `-Txdot` for the dot
+     *               file printed by `snap`
+     * @return The number of nodes of `snap` with a position
+     */
+    size_t load(const Snapshot &snap, StrRef layout) {
+        positions.clear();
+        auto add = [&](const std::string &name, double x, double y) {
+            auto it = snap.nodes.find(name);
+            if (it == snap.nodes.end()) return;
+            positions[name] = Pos{x, y, it->second.hash};
+        };
+        if (layout.size() >= 6 && memcmp(layout.data(), "graph ", 6) == 0)
+            loadPlain(layout, add);
+        else
+            loadDot(layout, add);
+        return positions.size();
+    }
+
+    /**
+     * @brief Print `snap` with the unchanged nodes pinned
+     */
+    std::string print(const Snapshot &snap) const { return snap.print(this); }
+
+    /**
+     * @brief Number of nodes pinned by the last `print`
+     */
+    size_t pinned() const { return lastPinned; }
+
+    size_t size() const { return positions.size(); }
+    void   clear() { positions.clear(); }
+
+  private:
+    friend class Snapshot;
+
+    struct Pos {
+        double   x, y; // in points
+        uint64_t hash; // of the node when it was laid out
+    };
+
+    // `node name x y ...` in inches, after `graph scale width height`
+    template <class F> static void loadPlain(StrRef layout, F &add) {
+        std::istringstream in(layout.str());
+        std::string        line, kind, name;
+        while (std::getline(in, line)) {
+            std::istringstream ls(line);
+            double             x, y;
+            if (!(ls >> kind) || kind != "node") continue;
+            ls >> std::ws;
+            if (ls.peek() == '"') {
+                char c;
+                ls.get();
+                name.clear();
+                while (ls.get(c) && c != '"') {
+                    if (c == '\\' && ls.get(c)) {}
+                    name += c;
+                }
+            } else {
+                ls >> name;
+            }
+            if (ls >> x >> y) add(name, x * 72, y * 72);
+        }
+    }
+
+    // node statements `name [... pos="x,y" ...];` in points
+    template <class F> static void loadDot(StrRef layout, F &add) {
+        std::string stmt;
+        int         angle   = 0;
+        bool        quoted  = false;
+        auto        finish  = [&]() {
+            statement(stmt, add);
+            stmt.clear();
+        };
+        for (size_t i = 0; i < layout.size(); ++i) {
+            char c = layout[i];
+            if (c == '\\' && i + 1 < layout.size() && layout[i + 1] == '\n') {
+                ++i; // a line continued by graphviz
+                continue;
+            }
+            if (angle > 0) {
+                angle += c == '<' ? 1 : c == '>' ? -1 : 0;
+            } else if (quoted) {
+                if (c == '\\' && i + 1 < layout.size()) {
+                    stmt += c;
+                    c = layout[++i];
+                } else if (c == '"') {
+                    quoted = false;
+                }
+            } else if (c == '"') {
+                quoted = true;
+            } else if (c == '<') {
+                angle = 1;
+            } else if (c == ';' || c == '{' || c == '}' || c == '\n') {
+                if (c != '\n' || stmt.find('[') == std::string::npos ||
+                    stmt.find(']') != std::string::npos) {
+                    finish();
+                    continue;
+                }
+            }
+            stmt += c;
+        }
+        finish();
+    }
+
+    template <class F> static void statement(const std::string &s, F &add) {
+        size_t bracket = s.find('[');
+        if (bracket == std::string::npos) return;
+        std::string head = s.substr(0, bracket);
+        if (head.find("->") != std::string::npos) return;
+        size_t b = head.find_first_not_of(" \t\r\n");
+        size_t e = head.find_last_not_of(" \t\r\n");
+        if (b == std::string::npos) return;
+        std::string name = head.substr(b, e - b + 1);
+        if (name == "graph" || name == "node" || name == "edge") return;
+        if (name.size() >= 2 && name[0] == '"' && name.back() == '"')
+            name = name.substr(1, name.size() - 2);
+
+        size_t p = s.find("pos=\"", bracket);
+        if (p == std::string::npos) return;
+        double x, y;
+        if (sscanf(s.c_str() + p + 5, "%lf,%lf", &x, &y) == 2) add(name, x, y);
+    }
+
+    std::map<std::string, Pos> positions;
+    mutable size_t             lastPinned = 0;
+};
+
+inline std::string
+Snapshot::print(const LayoutCache *layout) const {
+    if (!layout) return render(nullptr);
+    layout->lastPinned = 0;
+    return render([this, layout](const std::string &name, std::string &body) {
+        auto it = layout->positions.find(name);
+        if (it == layout->positions.end() ||
+            it->second.hash != nodes.at(name).hash)
+            return;
+        size_t end = body.rfind(']');
+        if (end == std::string::npos) return;
+        char pos[64];
+        snprintf(pos, sizeof pos, " pos=\"%.2f,%.2f!\"", it->second.x,
+                 it->second.y);
+        body.insert(end, pos);
+        ++layout->lastPinned;
+    });
+}
+
+#ifdef DSVIZ_HAS_FD
+/**
+ * @brief A stream buffer writing to a file descriptor, the descriptor is not
+ *        closed by this class
+ */
+class FdBuf : public std::streambuf {
+  public:
+    explicit FdBuf(int fd) : fd(fd) { setp(buf, buf + sizeof(buf)); }
+    virtual ~FdBuf() { sync(); }
+
+  protected:
+    virtual int_type overflow(int_type c) override {
+        if (flushBuf() < 0) return traits_type::eof();
+        if (!traits_type::eq_int_type(c, traits_type::eof())) {
+            *pptr() = traits_type::to_char_type(c);
+            pbump(1);
+        }
+        return traits_type::not_eof(c);
+    }
+
+    virtual int sync() override { return flushBuf(); }
+
+  private:
+    int flushBuf() {
+        char *p = pbase();
+        while (p < pptr()) {
+            ssize_t n = ::write(fd, p, pptr() - p);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                return -1;
+            }
+            p += n;
+        }
+        setp(buf, buf + sizeof(buf));
+        return 0;
+    }
+
+    int  fd;
+    char buf[1 << 16];
+};
+#endif
+
+/**
+ * @brief A dot file which is written to a stream while it is being built
+ * @details Each node, edge and subgraph is written as soon as it is added,
+ *          so only the names of the visited nodes are kept in memory. Unlike
+ *          `Dot`, repeated edges between the same ports are written again
+ *          instead of being merged. The graph is closed by `close()` or the
+ *          destructor.
+ */
+class StreamingDot : public Dot {
+  public:
+    StreamingDot(std::ostream &out, Config config = {})
+        : Dot(config), out(&out) {
+        begin();
+    }
+
+#ifdef DSVIZ_HAS_FD
+    StreamingDot(int fd, Config config = {})
+        : Dot(config), fdbuf(new FdBuf(fd)),
+          fdout(new std::ostream(fdbuf.get())), out(fdout.get()) {
+        begin();
+    }
+#endif
+
+    virtual ~StreamingDot() { close(); }
+
+    /**
+     * @brief Finish the graph and flush the stream
+     */
+    void close() {
+        if (closed) return;
+        *out << "}" << std::endl;
+        closed = true;
+    }
+
+    /**
+     * @brief Everything is already written to the stream
+     * @return An empty string
+     */
+    virtual std::string print() const override { return std::string(); }
+    virtual void        print(Writer &) const override {}
+    using Dot::print;
+
+    using Dot::addEdge;
+
+    virtual void addEdge(std::string from, std::string to,
+                         std::string edge = "") override {
+        assert(!from.empty());
+        assert(!to.empty());
+        bytes += from.size() + to.size() + edge.size() + 7;
+        *out << from << " -> " << to << " " << edge << ";\n";
+    }
+
+    virtual void addNode(std::string name, std::string node) override {
+        assert(!name.empty());
+        bytes += name.size() + node.size() + 3;
+        *out << name << " " << node << ";\n";
+    }
+
+    virtual void addSubGraph(std::string subgraph) override {
+        bytes += subgraph.size() + 1;
+        *out << subgraph << "\n";
+    }
+
+    virtual void addCluster(std::unique_ptr<Cluster> cluster) override {
+        struct {
+            std::ostream *out;
+            void write(const char *s, size_t n) { out->write(s, n); }
+            void write(const std::string &s) { *out << s; }
+        } w{out};
+        bytes += cluster->bytes + 1;
+        cluster->write(w);
+        *out << "\n";
+    }
+
+  private:
+    void begin() {
+        *out << "digraph structs {" << std::endl;
+        *out << config.genGraphStyle() << std::endl;
+    }
+
+#ifdef DSVIZ_HAS_FD
+    std::unique_ptr<FdBuf>        fdbuf;
+    std::unique_ptr<std::ostream> fdout;
+#endif
+    std::ostream *out;
+    bool          closed = false;
+};
+
+/**
+ * @brief Tags and encodings of the binary capture format
+ * @details A capture starts with the magic "DSVB", a version byte and the
+ *          four `Config` strings, followed by records. Every record is a tag
+ *          byte and LEB128 varints. Strings appear once as a `Str` record and
+ *          are referenced by number after that. Node names of the form
+ *          `_nodeN[:_portM]` are stored as numbers.
+ */
+struct BinaryFormat {
+    enum Tag : uint8_t {
+        End = 0,
+        Str,        // len, bytes         defines the next string id
+        NodeBegin,  // name, span         opens a table node and selects it
+        Select,     // handle             selects an open table node
+        RowBegin,   //
+        RowEnd,     //
+        CellName,   // name id, attr id
+        CellValue,  // flags, value, attr id, port
+        NodeEnd,    // shape id, style id, n, n * (key id, value id)
+        RawNode,    // name, len, bytes
+        RawEdge,    // from, to, attr id
+        RawSubGraph // len, bytes
+    };
+
+    // value kinds stored in the low bits of the CellValue flags
+    enum ValueKind : uint8_t {
+        VString = 0,
+        VInt,
+        VUInt,
+        VDouble,
+        VFalse,
+        VTrue,
+        VSpanned = 8
+    };
+
+    static const uint8_t version = 1;
+
+    static void putVarint(std::string &out, uint64_t v) {
+        while (v >= 0x80) {
+            out += char(v | 0x80);
+            v >>= 7;
+        }
+        out += char(v);
+    }
+
+    static void putString(std::string &out, StrRef s) {
+        putVarint(out, s.size());
+        out += s;
+    }
+
+    /**
+     * @brief Split `_nodeN[:_portM]` into numbers
+     * @return False if the name has another form
+     */
+    static bool parseName(StrRef s, uint64_t &node, bool &hasPort,
+                          uint64_t &port) {
+        size_t i = 0;
+        if (!number(s, i, "_node", node)) return false;
+        hasPort = i != s.size();
+        if (!hasPort) return true;
+        if (s[i] != ':') return false;
+        ++i;
+        return number(s, i, "_port", port) && i == s.size();
+    }
+
+    static bool parsePort(StrRef s, uint64_t &port) {
+        size_t i = 0;
+        return number(s, i, "_port", port) && i == s.size();
+    }
+
+  private:
+    static bool number(StrRef s, size_t &i, const char *prefix,
+                       uint64_t &n) {
+        for (; *prefix; ++prefix, ++i)
+            if (i == s.size() || s[i] != *prefix) return false;
+        size_t start = i;
+        n            = 0;
+        for (; i < s.size() && s[i] >= '0' && s[i] <= '9'; ++i)
+            n = n * 10 + (s[i] - '0');
+        // a leading zero would not come back the same
+        return i != start && i - start < 20 &&
+               (s[start] != '0' || i == start + 1);
+    }
+};
+
+/**
+ * @brief A Dot that records the graph in a compact binary form
+ * @details Table nodes are stored as their raw fields instead of HTML labels,
+ *          so the capture is much smaller and cheaper to produce than the dot
+ *          text. Turn it into dot or JSON later with `BinaryLog` or the
+ *          `dsvconv` tool.
+ */
+class BinaryCapture : public Dot, public Recorder {
+  public:
+    BinaryCapture(std::ostream &out, Config config = {})
+        : Dot(config), out(&out) {
+        buf.reserve(flushSize * 2);
+        buf.append("DSVB", 4);
+        buf += char(BinaryFormat::version);
+        BinaryFormat::putString(buf, config.node_style);
+        BinaryFormat::putString(buf, config.edge_style);
+        BinaryFormat::putString(buf, config.graph_style);
+        BinaryFormat::putString(buf, config.other);
+    }
+
+    virtual ~BinaryCapture() { close(); }
+
+    /**
+     * @brief Finish the capture and flush the stream
+     */
+    void close() {
+        if (closed) return;
+        buf += char(BinaryFormat::End);
+        flush();
+        out->flush();
+        closed = true;
+    }
+
+    /**
+     * @brief Everything is already written to the stream
+     * @return An empty string
+     */
+    virtual std::string print() const override { return std::string(); }
+    virtual void        print(Writer &) const override {}
+    using Dot::print;
+
+    virtual Recorder *recorder() override { return this; }
+
+    using Dot::addEdge;
+
+    virtual void addEdge(std::string from, std::string to,
+                         std::string edge = "") override {
+        assert(!from.empty());
+        assert(!to.empty());
+        uint32_t a = intern(edge);
+        if (!isNumbered(from)) intern(from);
+        if (!isNumbered(to)) intern(to);
+        record(BinaryFormat::RawEdge);
+        putName(from);
+        putName(to);
+        BinaryFormat::putVarint(buf, a);
+        done();
+    }
+
+    virtual void addNode(std::string name, std::string node) override {
+        assert(!name.empty());
+        if (!isNumbered(name)) intern(name);
+        record(BinaryFormat::RawNode);
+        putName(name);
+        BinaryFormat::putString(buf, node);
+        done();
+    }
+
+    virtual void addSubGraph(std::string subgraph) override {
+        record(BinaryFormat::RawSubGraph);
+        BinaryFormat::putString(buf, subgraph);
+        done();
+    }
+
+    virtual void addCluster(std::unique_ptr<Cluster> cluster) override {
+        IViz::addCluster(std::move(cluster));
+    }
+
+    virtual uint32_t beginNode(const std::string &name, int span) override {
+        if (!isNumbered(name)) intern(name);
+        record(BinaryFormat::NodeBegin);
+        putName(name);
+        BinaryFormat::putVarint(buf, span);
+        selected = handles++;
+        done();
+        return selected;
+    }
+
+    virtual void beginRow(uint32_t node) override {
+        select(node);
+        record(BinaryFormat::RowBegin);
+        done();
+    }
+
+    virtual void endRow(uint32_t node) override {
+        select(node);
+        record(BinaryFormat::RowEnd);
+        done();
+    }
+
+    virtual void cellName(uint32_t node, StrRef name, StrRef attr) override {
+        uint32_t n = intern(name), a = intern(attr);
+        select(node);
+        record(BinaryFormat::CellName);
+        BinaryFormat::putVarint(buf, n);
+        BinaryFormat::putVarint(buf, a);
+        done();
+    }
+
+    virtual void cellValue(uint32_t node, const Value &value, StrRef attr,
+                           StrRef port, bool spanned) override {
+        uint32_t a = intern(attr), custom = 0;
+        uint64_t p = 0, n;
+        if (BinaryFormat::parsePort(port, n))
+            p = n + 2;
+        else if (!port.empty())
+            p = 1, custom = intern(port);
+        select(node);
+        record(BinaryFormat::CellValue);
+        uint8_t flags = spanned ? BinaryFormat::VSpanned : 0;
+        switch (value.kind) {
+        case Value::String:
+            buf += char(flags | BinaryFormat::VString);
+            BinaryFormat::putString(buf, value.s);
+            break;
+        case Value::Int:
+            buf += char(flags | BinaryFormat::VInt);
+            BinaryFormat::putVarint(buf, (uint64_t(value.i) << 1) ^
+                                             uint64_t(value.i >> 63));
+            break;
+        case Value::UInt:
+            buf += char(flags | BinaryFormat::VUInt);
+            BinaryFormat::putVarint(buf, value.u);
+            break;
+        case Value::Double: {
+            buf += char(flags | BinaryFormat::VDouble);
+            uint64_t bits;
+            memcpy(&bits, &value.d, sizeof bits);
+            for (int i = 0; i < 8; ++i) buf += char(bits >> (i * 8));
+            break;
+        }
+        case Value::Bool:
+            buf += char(flags |
+                        (value.b ? BinaryFormat::VTrue : BinaryFormat::VFalse));
+            break;
+        }
+        BinaryFormat::putVarint(buf, a);
+        BinaryFormat::putVarint(buf, p);
+        if (p == 1) BinaryFormat::putVarint(buf, custom);
+        done();
+    }
+
+    virtual void
+    endNode(uint32_t node, const std::string &shape, const std::string &style,
+            const std::map<std::string, std::string> &attrs) override {
+        uint32_t s = intern(shape), t = intern(style);
+        for (auto &kv : attrs) intern(kv.first), intern(kv.second);
+        select(node);
+        record(BinaryFormat::NodeEnd);
+        BinaryFormat::putVarint(buf, s);
+        BinaryFormat::putVarint(buf, t);
+        BinaryFormat::putVarint(buf, attrs.size());
+        for (auto &kv : attrs) {
+            BinaryFormat::putVarint(buf, strings.at(kv.first));
+            BinaryFormat::putVarint(buf, strings.at(kv.second));
+        }
+        done();
+        selected = npos;
+    }
+
+  private:
+    enum : uint32_t { npos = 0xffffffffu };
+    static const size_t flushSize = 1 << 16;
+
+    bool isNumbered(const std::string &name) const {
+        uint64_t n, p;
+        bool     port;
+        return BinaryFormat::parseName(name, n, port, p);
+    }
+
+    uint32_t intern(StrRef ref) {
+        key.assign(ref.data(), ref.size());
+        auto it = strings.find(key);
+        if (it != strings.end()) return it->second;
+        uint32_t id = strings.size();
+        strings.emplace(key, id);
+        record(BinaryFormat::Str);
+        BinaryFormat::putString(buf, key);
+        done();
+        return id;
+    }
+
+    // 0 and a string id, or (N << 1 | hasPort) + 1 and the port number
+    void putName(const std::string &name) {
+        uint64_t n, p;
+        bool     port;
+        if (!BinaryFormat::parseName(name, n, port, p)) {
+            BinaryFormat::putVarint(buf, 0);
+            BinaryFormat::putVarint(buf, strings.at(name));
+            return;
+        }
+        BinaryFormat::putVarint(buf, ((n << 1) | port) + 1);
+        if (port) BinaryFormat::putVarint(buf, p);
+    }
+
+    void select(uint32_t node) {
+        if (node == selected) return;
+        record(BinaryFormat::Select);
+        BinaryFormat::putVarint(buf, node);
+        done();
+        selected = node;
+    }
+
+    void record(BinaryFormat::Tag tag) {
+        mark = buf.size();
+        buf += char(tag);
+    }
+
+    void done() {
+        bytes += buf.size() - mark;
+        if (buf.size() >= flushSize) flush();
+    }
+
+    void flush() {
+        out->write(buf.data(), buf.size());
+        buf.clear();
+    }
+
+    std::ostream                             *out;
+    std::string                               buf;
+    size_t                                    mark = 0;
+    std::unordered_map<std::string, uint32_t> strings;
+    std::string                               key; // reused by intern
+    uint32_t                                  handles  = 0;
+    uint32_t                                  selected = npos;
+    bool                                      closed   = false;
+};
+
+/**
+ * @brief Reads a capture written by `BinaryCapture`
+ * @details The log does not copy the data, so keep it alive (for example a
+ *          mapped file) while using the log.
+ */
+class BinaryLog {
+  public:
+    BinaryLog(const char *data, size_t size) : data(data), size(size) {}
+
+    /**
+     * @brief The config the capture was made with
+     */
+    Config config() const {
+        Config c;
+        Cursor in{data, data + size};
+        if (!header(in)) return c;
+        in.str(c.node_style), in.str(c.edge_style), in.str(c.graph_style),
+            in.str(c.other);
+        return c;
+    }
+
+    /**
+     * @brief Replay the capture into a graph
+     * @details Table nodes are rebuilt with `TableNode`, so a `Dot` made with
+     *          `config()` prints the same text as the graph that was captured.
+     * @return False if the capture is malformed or truncated
+     */
+    bool render(IViz &viz) const {
+        VizSink sink(viz);
+        return parse(sink);
+    }
+
+    /**
+     * @brief Render the capture as JSON
+     * @details Table nodes keep their fields as rows of cells, with numbers
+     *          and booleans left unformatted.
+     * @return An empty string if the capture is malformed or truncated
+     */
+    std::string json() const {
+        JsonSink sink;
+        if (!parse(sink)) return std::string();
+        Config c = config();
+        std::string s = "{\"config\":{\"node\":";
+        JsonSink::quote(s, c.node_style);
+        s += ",\"edge\":";
+        JsonSink::quote(s, c.edge_style);
+        s += ",\"graph\":";
+        JsonSink::quote(s, c.graph_style);
+        s += ",\"other\":";
+        JsonSink::quote(s, c.other);
+        s += "},\n\"nodes\":[" + sink.nodes + "],\n\"edges\":[" + sink.edges +
+             "],\n\"subgraphs\":[" + sink.subgraphs + "]}\n";
+        return s;
+    }
+
+  private:
+    struct Cursor {
+        const char *p, *end;
+
+        bool varint(uint64_t &v) {
+            v = 0;
+            for (int shift = 0; p != end && shift < 64; shift += 7) {
+                uint8_t b = *p++;
+                v |= uint64_t(b & 0x7f) << shift;
+                if (!(b & 0x80)) return true;
+            }
+            return false;
+        }
+
+        bool str(std::string &s) {
+            uint64_t n;
+            if (!varint(n) || n > uint64_t(end - p)) return false;
+            s.assign(p, n);
+            p += n;
+            return true;
+        }
+    };
+
+    struct Cell {
+        Value       value;
+        std::string text;
+    };
+
+    bool header(Cursor &in) const {
+        if (size < 5 || memcmp(data, "DSVB", 4) != 0 ||
+            uint8_t(data[4]) != BinaryFormat::version)
+            return false;
+        in.p += 5;
+        return true;
+    }
+
+    template <class Sink> bool parse(Sink &sink) const {
+        Cursor   in{data, data + size};
+        uint64_t n;
+        if (!header(in)) return false;
+        std::string skip;
+        for (int i = 0; i < 4; ++i)
+            if (!in.str(skip)) return false;
+
+        std::vector<std::string> strings;
+        uint32_t                 handles = 0, selected = 0;
+        std::string              a, b, c;
+        while (in.p != in.end) {
+            uint8_t tag = *in.p++;
+            switch (tag) {
+            case BinaryFormat::End: return true;
+            case BinaryFormat::Str:
+                strings.emplace_back();
+                if (!in.str(strings.back())) return false;
+                break;
+            case BinaryFormat::NodeBegin:
+                if (!name(in, strings, a) || !in.varint(n)) return false;
+                selected = handles++;
+                sink.beginNode(selected, a, int(n));
+                break;
+            case BinaryFormat::Select:
+                if (!in.varint(n) || n >= handles) return false;
+                selected = n;
+                break;
+            case BinaryFormat::RowBegin: sink.beginRow(selected); break;
+            case BinaryFormat::RowEnd: sink.endRow(selected); break;
+            case BinaryFormat::CellName: {
+                const std::string *x, *y;
+                if (!ref(in, strings, x) || !ref(in, strings, y)) return false;
+                sink.cellName(selected, *x, *y);
+                break;
+            }
+            case BinaryFormat::CellValue: {
+                if (in.p == in.end) return false;
+                uint8_t flags = *in.p++;
+                Value   v     = Value::of(false);
+                switch (flags & 7) {
+                case BinaryFormat::VString:
+                    if (!in.str(a)) return false;
+                    v = Value::of(a);
+                    break;
+                case BinaryFormat::VInt:
+                    if (!in.varint(n)) return false;
+                    v = Value::of(int64_t(n >> 1) ^ -int64_t(n & 1));
+                    break;
+                case BinaryFormat::VUInt:
+                    if (!in.varint(n)) return false;
+                    v = Value::of(uint64_t(n));
+                    break;
+                case BinaryFormat::VDouble: {
+                    if (in.end - in.p < 8) return false;
+                    uint64_t bits = 0;
+                    for (int i = 0; i < 8; ++i)
+                        bits |= uint64_t(uint8_t(in.p[i])) << (i * 8);
+                    in.p += 8;
+                    double d;
+                    memcpy(&d, &bits, sizeof d);
+                    v = Value::of(d);
+                    break;
+                }
+                case BinaryFormat::VFalse: v = Value::of(false); break;
+                case BinaryFormat::VTrue: v = Value::of(true); break;
+                default: return false;
+                }
+                const std::string *attr;
+                if (!ref(in, strings, attr) || !in.varint(n)) return false;
+                b.clear();
+                if (n == 1) {
+                    const std::string *port;
+                    if (!ref(in, strings, port)) return false;
+                    b = *port;
+                } else if (n > 1) {
+                    b = "_port" + std::to_string(n - 2);
+                }
+                sink.cellValue(selected, v, *attr, b,
+                               flags & BinaryFormat::VSpanned);
+                break;
+            }
+            case BinaryFormat::NodeEnd: {
+                const std::string *shape, *style, *k, *v;
+                std::map<std::string, std::string> attrs;
+                if (!ref(in, strings, shape) || !ref(in, strings, style) ||
+                    !in.varint(n))
+                    return false;
+                for (uint64_t i = 0; i < n; ++i) {
+                    if (!ref(in, strings, k) || !ref(in, strings, v))
+                        return false;
+                    attrs[*k] = *v;
+                }
+                sink.endNode(selected, *shape, *style, attrs);
+                break;
+            }
+            case BinaryFormat::RawNode:
+                if (!name(in, strings, a) || !in.str(b)) return false;
+                sink.addNode(a, b);
+                break;
+            case BinaryFormat::RawEdge: {
+                const std::string *attr;
+                if (!name(in, strings, a) || !name(in, strings, b) ||
+                    !ref(in, strings, attr))
+                    return false;
+                sink.addEdge(a, b, *attr);
+                break;
+            }
+            case BinaryFormat::RawSubGraph:
+                if (!in.str(a)) return false;
+                sink.addSubGraph(a);
+                break;
+            default: return false;
+            }
+        }
+        return false;
+    }
+
+    static bool ref(Cursor &in, const std::vector<std::string> &strings,
+                    const std::string *&s) {
+        uint64_t n;
+        if (!in.varint(n) || n >= strings.size()) return false;
+        s = &strings[n];
+        return true;
+    }
+
+    static bool name(Cursor &in, const std::vector<std::string> &strings,
+                     std::string &s) {
+        uint64_t x, port;
+        if (!in.varint(x)) return false;
+        if (x == 0) {
+            const std::string *r;
+            if (!ref(in, strings, r)) return false;
+            s = *r;
+            return true;
+        }
+        --x;
+        s = "_node" + std::to_string(x >> 1);
+        if (x & 1) {
+            if (!in.varint(port)) return false;
+            s += ":_port" + std::to_string(port);
+        }
+        return true;
+    }
+
+    // rebuilds the graph through the public API
+    struct VizSink {
+        explicit VizSink(IViz &viz) : viz(viz) {}
+        ~VizSink() {
+            for (auto &kv : open) delete kv.second;
+        }
+
+        void beginNode(uint32_t h, const std::string &name, int span) {
+            open[h] = new TableNode(viz, span, name);
+        }
+        void beginRow(uint32_t h) {
+            if (TableNode *n = get(h)) n->beginRow();
+        }
+        void endRow(uint32_t h) {
+            if (TableNode *n = get(h)) n->endRow();
+        }
+        void cellName(uint32_t h, StrRef name, StrRef attr) {
+            if (TableNode *n = get(h)) n->attr_name(name, attr);
+        }
+        void cellValue(uint32_t h, const Value &v, StrRef attr, StrRef port,
+                       bool spanned) {
+            TableNode *n = get(h);
+            if (!n) return;
+            if (spanned)
+                n->attr_value(v.format(), attr, port);
+            else
+                n->attr_value_nospan(v.format(), attr, port);
+        }
+        void endNode(uint32_t h, const std::string &shape,
+                     const std::string                        &style,
+                     const std::map<std::string, std::string> &attrs) {
+            TableNode *n = get(h);
+            if (!n) return;
+            n->shape = shape;
+            n->style = style;
+            for (auto &kv : attrs) n->addAttr(kv.first, kv.second);
+            open.erase(h);
+            delete n;
+        }
+        void addNode(const std::string &name, const std::string &body) {
+            viz.addNode(name, body);
+        }
+        void addEdge(const std::string &from, const std::string &to,
+                     const std::string &attr) {
+            viz.addEdge(from, to, attr);
+        }
+        void addSubGraph(const std::string &s) { viz.addSubGraph(s); }
+
+        TableNode *get(uint32_t h) {
+            auto it = open.find(h);
+            return it == open.end() ? nullptr : it->second;
+        }
+
+        IViz                           &viz;
+        std::map<uint32_t, TableNode *> open;
+    };
+
+    struct JsonSink {
+        static void quote(std::string &out, StrRef s) { jsonQuote(out, s); }
+
+        static void sep(std::string &out) {
+            if (!out.empty() && out.back() != '[') out += ",\n";
+        }
+
+        void beginNode(uint32_t h, const std::string &name, int span) {
+            std::string &n = open[h];
+            n              = "{\"name\":";
+            quote(n, name);
+            n += ",\"span\":" + std::to_string(span) + ",\"rows\":[";
+        }
+        void beginRow(uint32_t h) {
+            std::string &n = open[h];
+            if (n.back() != '[') n += ",";
+            n += "[";
+        }
+        void endRow(uint32_t h) { open[h] += "]"; }
+        void cellName(uint32_t h, StrRef name, StrRef attr) {
+            std::string &n = open[h];
+            if (n.back() != '[') n += ",";
+            n += "{\"name\":";
+            quote(n, name);
+            n += ",\"attr\":";
+            quote(n, attr);
+            n += "}";
+        }
+        void cellValue(uint32_t h, const Value &v, StrRef attr, StrRef port,
+                       bool spanned) {
+            std::string &n = open[h];
+            if (n.back() != '[') n += ",";
+            n += "{\"value\":";
+            switch (v.kind) {
+            case Value::String: quote(n, v.s); break;
+            case Value::Double:
+                // JSON has no inf or nan
+                if (v.d - v.d == 0) {
+                    char num[32];
+                    snprintf(num, sizeof num, "%.17g", v.d);
+                    n += num;
+                } else {
+                    quote(n, v.format());
+                }
+                break;
+            default: n += v.format();
+            }
+            n += ",\"attr\":";
+            quote(n, attr);
+            if (!port.empty()) {
+                n += ",\"port\":";
+                quote(n, port);
+            }
+            if (!spanned) n += ",\"nospan\":true";
+            n += "}";
+        }
+        void endNode(uint32_t h, const std::string &shape,
+                     const std::string                        &style,
+                     const std::map<std::string, std::string> &attrs) {
+            std::string &n = open[h];
+            n += "],\"shape\":";
+            quote(n, shape);
+            n += ",\"style\":";
+            quote(n, style);
+            n += ",\"attrs\":{";
+            bool first = true;
+            for (auto &kv : attrs) {
+                if (!first) n += ",";
+                first = false;
+                quote(n, kv.first);
+                n += ":";
+                quote(n, kv.second);
+            }
+            n += "}}";
+            sep(nodes);
+            nodes += n;
+            open.erase(h);
+        }
+        void addNode(const std::string &name, const std::string &body) {
+            sep(nodes);
+            nodes += "{\"name\":";
+            quote(nodes, name);
+            nodes += ",\"body\":";
+            quote(nodes, body);
+            nodes += "}";
+        }
+        void addEdge(const std::string &from, const std::string &to,
+                     const std::string &attr) {
+            sep(edges);
+            edges += "{\"from\":";
+            quote(edges, from);
+            edges += ",\"to\":";
+            quote(edges, to);
+            edges += ",\"attr\":";
+            quote(edges, attr);
+            edges += "}";
+        }
+        void addSubGraph(const std::string &s) {
+            sep(subgraphs);
+            quote(subgraphs, s);
+        }
+
+        std::map<uint32_t, std::string> open;
+        std::string                     nodes, edges, subgraphs;
+    };
+
+    const char *data;
+    size_t      size;
+};
+
+/**
+ * @brief What `AsyncCapture` does when its queue is full
+ */
+enum class Overflow {
+    Block,      // wait for the worker to take a capture
+    DropNewest, // skip the new capture
+    DropOldest  // drop the oldest capture which is not rendered yet
+};
+
+/**
+ * @brief Options of `AsyncCapture`
+ */
+struct AsyncOptions {
+    size_t   queue    = 4; // captures waiting for the worker, at least 1
+    Overflow overflow = Overflow::Block;
+    Config   config;
+    Budget   budget; // of each capture
+};
+
+/**
+ * @brief Captures on the calling thread and renders on a background thread
+ * @details The calling thread only runs the walk into a `BinaryCapture`,
+ *          which keeps the fields of table nodes raw. A worker thread then
+ *          replays each capture into a `Dot`, which builds and escapes the
+ *          labels, and prints it. Captures may be made from several threads.
+ *
+ *          Only the rendering is asynchronous: `load_ds` still calls every
+ *          `dsviz_show` and returns once the whole walk is recorded. The
+ *          record is then copied into a queue which a mutex guards, and it
+ *          is not streamed to the worker while the walk runs.
+ *
+ *          A capture which is dropped by the overflow policy completes with
+ *          an empty string and its callback is not called. The destructor
+ *          renders the captures still queued before it returns.
+ */
+class AsyncCapture {
+  public:
+    typedef std::function<void(const Dot &)> Callback;
+
+    struct Counts {
+        size_t captured = 0; // walks run on a calling thread
+        size_t rendered = 0;
+        size_t dropped  = 0;
+    };
+
+    AsyncCapture(AsyncOptions options = {})
+        : options(checked(options)), worker(&AsyncCapture::work, this) {}
+
+    AsyncCapture(const AsyncCapture &)            = delete;
+    AsyncCapture &operator=(const AsyncCapture &) = delete;
+
+    ~AsyncCapture() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        ready.notify_all();
+        worker.join();
+    }
+
+    /**
+     * @brief Capture a data structure and render it later
+     * @param done Called on the worker thread with the rendered graph
+     * @return The printed graph, or an empty string if it was dropped
+     */
+    std::future<std::string> load_ds(IDataStructure *ds,
+                                     Callback        done = nullptr) {
+        return submit([ds](Dot &cap) { cap.load_ds(ds); }, std::move(done));
+    }
+
+    /**
+     * @brief Capture a data structure shown by `dsviz_show(T*, IViz&)`
+     */
+    template <class T>
+    std::future<std::string> load_ds_c(T *ds, Callback done = nullptr) {
+        return submit([ds](Dot &cap) { cap.load_ds_c(ds); }, std::move(done));
+    }
+
+    Counts counts() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return totals;
+    }
+
+  private:
+    struct Job {
+        std::string                data; // the binary capture
+        Callback                   done;
+        std::promise<std::string>  result;
+    };
+
+    std::future<std::string> submit(const std::function<void(Dot &)> &walk,
+                                     Callback                          done) {
+        std::unique_ptr<Job>     job(new Job());
+        std::future<std::string> result = job->result.get_future();
+        job->done                       = std::move(done);
+        if (options.overflow == Overflow::DropNewest && full()) {
+            drop(*job);
+            return result;
+        }
+
+        std::stringstream ss;
+        {
+            BinaryCapture cap(ss, options.config);
+            cap.setBudget(options.budget);
+            walk(cap);
+        }
+        job->data = ss.str();
+
+        std::unique_ptr<Job>         old;
+        std::unique_lock<std::mutex> lock(mutex);
+        ++totals.captured;
+        if (queue.size() >= options.queue) {
+            switch (options.overflow) {
+            case Overflow::Block:
+                taken.wait(lock,
+                           [this] { return queue.size() < options.queue; });
+                break;
+            case Overflow::DropNewest:
+                lock.unlock();
+                drop(*job);
+                return result;
+            case Overflow::DropOldest:
+                old = std::move(queue.front());
+                queue.pop_front();
+                break;
+            }
+        }
+        queue.push_back(std::move(job));
+        lock.unlock();
+        ready.notify_one();
+        if (old) drop(*old);
+        return result;
+    }
+
+    static AsyncOptions checked(AsyncOptions options) {
+        options.queue = std::max<size_t>(options.queue, 1);
+        return options;
+    }
+
+    bool full() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return queue.size() >= options.queue;
+    }
+
+    void drop(Job &job) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            ++totals.dropped;
+        }
+        job.result.set_value(std::string());
+    }
+
+    void work() {
+        while (true) {
+            std::unique_ptr<Job> job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                ready.wait(lock, [this] { return stopping || !queue.empty(); });
+                if (queue.empty()) return;
+                job = std::move(queue.front());
+                queue.pop_front();
+            }
+            taken.notify_one();
+
+            BinaryLog log(job->data.data(), job->data.size());
+            Dot       dot(log.config());
+            log.render(dot);
+            if (job->done) job->done(dot);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                ++totals.rendered;
+            }
+            job->result.set_value(dot.print());
+        }
+    }
+
+    AsyncOptions                     options;
+    mutable std::mutex               mutex;
+    std::condition_variable          ready, taken;
+    std::deque<std::unique_ptr<Job>> queue;
+    Counts                           totals;
+    bool                             stopping = false;
+    std::thread                      worker;
+};
+
+/**
+ * @brief A set of pointers which can be inserted into from many threads
+ * @details The pointers are spread over lock-striped `PtrIndex` tables.
+ */
+class ConcurrentPtrSet {
+  public:
+    /**
+     * @brief Insert a pointer
+     * @return True if the pointer was not in the set before
+     */
+    bool insert(const void *key) {
+        Stripe                     &s = stripe(key);
+        std::lock_guard<std::mutex> lock(s.mutex);
+        size_t                      before = s.index.size();
+        s.index.insert(key, 0);
+        return s.index.size() != before;
+    }
+
+    bool contains(const void *key) {
+        Stripe                     &s = stripe(key);
+        std::lock_guard<std::mutex> lock(s.mutex);
+        return s.index.find(key) != PtrIndex::npos;
+    }
+
+  private:
+    struct Stripe {
+        std::mutex mutex;
+        PtrIndex   index;
+        char       pad[64]; // keep the locks on different cache lines
+    };
+
+    Stripe &stripe(const void *key) {
+        uint64_t x = (uint64_t)(uintptr_t)key;
+        x ^= x >> 29;
+        x *= 0xbf58476d1ce4e5b9ULL;
+        return stripes[(x >> 58) & 63];
+    }
+
+    Stripe stripes[64];
+};
+
+/**
+ * @brief Options of `ParallelWalker`
+ */
+struct ParallelOptions {
+    // number of worker threads, 0 for std::thread::hardware_concurrency()
+    unsigned threads = 0;
+    // merge the result in the order a serial `load_ds` would produce it
+    bool deterministic = true;
+};
+
+/**
+ * @brief Loads a data structure into a graph with several threads
+ * @details The `dsviz_show` callbacks run on a pool of worker threads. Each
+ *          worker keeps a deque of nodes to show and steals from the others
+ *          when it runs out; a node is claimed in a shared visited set before
+ *          it is queued, so it is shown once. A worker records what the
+ *          callbacks add with placeholder names, and the records are replayed
+ *          into the target graph after all workers are done.
+ *
+ *          With `deterministic` set, the records are replayed in the order
+ *          the serial traversal of the target would show the nodes, and the
+ *          output is the same as `viz.load_ds(ds)` as long as the callbacks
+ *          do not depend on each other. Nodes reached through a `SubGraph`
+ *          are shown by the thread that owns the subgraph, and may be placed
+ *          differently from a serial walk.
+ *
+ *          The workers claim no more nodes than the node limit of
+ *          `viz.getBudget()` and none deeper than its depth limit, counting
+ *          the depth along the path they reached the node by. They stop
+ *          claiming nodes once what they recorded reaches the byte limit,
+ *          and stop showing them once the time limit has passed since
+ *          `load_ds` was called. The whole budget is applied with `admit`
+ *          when replaying, and a node which the workers left out but the
+ *          budget allows is shown on the calling thread then.
+ *
+ *          The callbacks must be safe to run concurrently. While they run,
+ *          `hasNode` only knows the nodes named before the walk and by the
+ *          current callback, and `Mock::get` uses the `MockScope` current on
+ *          the thread which called `load_ds`, shared for the walk.
+ */
+class ParallelWalker {
+  public:
+    ParallelWalker(IViz &viz, ParallelOptions options = {})
+        : viz(viz), options(options) {}
+
+    /**
+     * @brief Load a data structure to the graph in parallel
+     * @param ds The pointer to the data structure
+     */
+    void load_ds(IDataStructure *ds) {
+        Shard seed(*this);
+        seed.load_ds(ds);
+        run(seed.children);
+    }
+
+    /**
+     * @brief Load a data structure shown by `dsviz_show(T*, IViz&)` in
+     *        parallel
+     * @param ds The pointer to the data structure
+     */
+    template <class T> void load_ds_c(T *ds) {
+        Shard seed(*this);
+        seed.load_ds_c(ds);
+        run(seed.children);
+    }
+
+  private:
+    typedef IViz::Pending Pending;
+
+    /**
+     * @brief A call made by a callback, to be replayed into the target graph
+     */
+    struct Op {
+        enum Kind { SetName, AddNode, AddEdge, AddEdgeTo, AddSubGraph };
+        Kind        kind;
+        void       *ds;
+        std::string a, b, c;
+    };
+
+    /**
+     * @brief One call of `dsviz_show` and everything it recorded
+     */
+    struct Task {
+        Pending              item;
+        uint32_t             id;
+        uint32_t             names[3] = {0, 0, 0}; // nodes, edges, ports
+        std::vector<Op>      ops;
+        std::vector<Pending> children;
+        bool                 shown    = false; // not past the deadline
+        bool                 replayed = false;
+    };
+
+    struct Worker {
+        std::mutex                         mutex;
+        std::deque<Task *>                 queue;
+        std::vector<std::unique_ptr<Task>> tasks; // the tasks it created
+    };
+
+    /**
+     * @brief The graph a worker hands to the callbacks
+     * @details Generated names are placeholders `\x1f<kind><task>.<n>\x1f`,
+     *          and a node named by another thread is referred to as
+     *          `\x1fR<pointer>\x1f`. Both are replaced when replaying, see
+     *          `apply`.
+     */
+    class Shard : public IViz {
+      public:
+        explicit Shard(ParallelWalker &w) : w(w) { walking = true; }
+
+        void begin(Task *t) { task = t; }
+        void end() {
+            task->children.swap(children);
+            children.clear();
+            local.clear();
+            localNames.clear();
+            task = nullptr;
+        }
+
+        virtual std::string print() const override { return std::string(); }
+
+        virtual std::string genNodeName() override { return token('N', 0); }
+        virtual std::string genEdgeName() override { return token('E', 1); }
+        virtual std::string genPortName() override { return token('P', 2); }
+
+        using IViz::addEdge;
+        virtual void addEdge(std::string from, std::string to,
+                             std::string edge = "") override {
+            record(Op::AddEdge, nullptr, from, to, edge);
+        }
+        virtual void addEdge(std::string from, void *to,
+                             std::string edge = "") override {
+            record(Op::AddEdgeTo, to, from, "", edge);
+        }
+
+        virtual void addNode(std::string name, std::string node) override {
+            record(Op::AddNode, nullptr, name, node, "");
+        }
+        virtual void addSubGraph(std::string sg) override {
+            record(Op::AddSubGraph, nullptr, sg, "", "");
+        }
+
+        virtual void setName(void *ds, std::string name) override {
+            uint32_t id = local.insert(ds, (uint32_t)localNames.size());
+            if (id == localNames.size())
+                localNames.push_back(std::make_pair(ds, name));
+            else
+                localNames[id].second = name;
+            record(Op::SetName, ds, name, "", "");
+        }
+
+        virtual std::string getName(void *ds) const override {
+            uint32_t id = local.find(ds);
+            if (id != PtrIndex::npos) return localNames[id].second;
+            if (w.viz.hasNode(ds)) return w.viz.getName(ds);
+            char buf[32];
+            snprintf(buf, sizeof(buf), "\x1fR%llx\x1f",
+                     (unsigned long long)(uintptr_t)ds);
+            return buf;
+        }
+
+        virtual void *getDS(std::string name) const override {
+            for (auto &p : localNames)
+                if (p.second == name) return p.first;
+            return w.viz.getDS(name);
+        }
+
+        virtual bool hasNode(void *ds) const override {
+            return local.find(ds) != PtrIndex::npos || w.viz.hasNode(ds);
+        }
+
+        virtual bool claim(void *ds) override {
+            return !hasNode(ds) && w.visited.insert(ds);
+        }
+
+        virtual const Summary &summary() const override {
+            return w.viz.summary();
+        }
+
+        virtual Budget getBudget() const override { return w.viz.getBudget(); }
+
+      private:
+        friend class ParallelWalker;
+
+        std::string token(char kind, int n) {
+            return "\x1f" + std::string(1, kind) + std::to_string(task->id) +
+                   "." + std::to_string(task->names[n]++) + "\x1f";
+        }
+
+        void record(Op::Kind kind, void *ds, std::string a, std::string b,
+                    std::string c) {
+            Op op;
+            op.kind = kind;
+            op.ds   = ds;
+            op.a    = std::move(a);
+            op.b    = std::move(b);
+            op.c    = std::move(c);
+            task->ops.push_back(std::move(op));
+        }
+
+        ParallelWalker &w;
+        Task           *task = nullptr;
+        PtrIndex        local;
+        std::vector<std::pair<void *, std::string>> localNames;
+    };
+
+    Task *newTask(Worker &owner, const Pending &item) {
+        Task *t = new Task();
+        t->item = item;
+        t->id   = nextId++;
+        owner.tasks.emplace_back(t);
+        return t;
+    }
+
+    void run(const std::vector<Pending> &roots) {
+        unsigned n = options.threads;
+        if (n == 0) n = std::max(1u, std::thread::hardware_concurrency());
+        workers.clear();
+        for (unsigned i = 0; i < n; ++i)
+            workers.emplace_back(new Worker());
+        nextId   = 0;
+        claimed  = 0;
+        recorded = 0;
+        limits   = viz.getBudget();
+        // the target's own clock starts at the merge, see `walk`
+        deadline = std::chrono::steady_clock::time_point::max();
+        if (limits.time_limit != std::chrono::steady_clock::duration::max())
+            deadline = std::chrono::steady_clock::now() + limits.time_limit;
+
+        for (auto &r : roots) {
+            if (!queue(r)) continue;
+            workers[0]->queue.push_back(newTask(*workers[0], r));
+            ++outstanding;
+            ++available;
+        }
+
+        // the callbacks take their mock objects from the caller's scope
+        MockScope               &mocks = MockScope::current();
+        MockScope::Share         share(mocks);
+        std::vector<std::thread> threads;
+        for (unsigned i = 1; i < n; ++i)
+            threads.emplace_back([this, i, &mocks] {
+                MockScope::Bind bind(mocks);
+                work(i);
+            });
+        work(0);
+        for (auto &t : threads)
+            t.join();
+
+        merge(roots);
+        workers.clear();
+    }
+
+    Task *pop(unsigned i) {
+        Worker                     &me = *workers[i];
+        std::lock_guard<std::mutex> lock(me.mutex);
+        if (me.queue.empty()) return nullptr;
+        Task *t = me.queue.back();
+        me.queue.pop_back();
+        --available;
+        return t;
+    }
+
+    // take the oldest task of another worker, which is closest to the root
+    Task *steal(unsigned i) {
+        for (size_t k = 1; k < workers.size(); ++k) {
+            Worker &other = *workers[(i + k) % workers.size()];
+            std::lock_guard<std::mutex> lock(other.mutex);
+            if (other.queue.empty()) continue;
+            Task *t = other.queue.front();
+            other.queue.pop_front();
+            --available;
+            return t;
+        }
+        return nullptr;
+    }
+
+    void work(unsigned i) {
+        Worker             &me = *workers[i];
+        Shard               shard(*this);
+        std::vector<Task *> fresh;
+        while (true) {
+            Task *t = pop(i);
+            if (t == nullptr) t = steal(i);
+            if (t == nullptr) {
+                if (outstanding.load() == 0) return;
+                park();
+                continue;
+            }
+            // past the deadline the rest is only drained
+            if (!expired()) show(shard, *t);
+
+            for (auto &c : t->children) {
+                c.depth = t->item.depth + 1;
+                if (queue(c)) fresh.push_back(newTask(me, c));
+            }
+            outstanding += fresh.size();
+            {
+                // reversed, so the first child is the next one popped
+                std::lock_guard<std::mutex> lock(me.mutex);
+                me.queue.insert(me.queue.end(), fresh.rbegin(), fresh.rend());
+            }
+            available += fresh.size();
+            if (!fresh.empty()) wake();
+            fresh.clear();
+            if (--outstanding == 0) wake();
+        }
+    }
+
+    /**
+     * @brief Wait until a task is queued or the walk is done
+     * @details `sleepers` is raised before the check and `available` before
+     *          `wake` reads `sleepers`, so a task queued meanwhile is either
+     *          seen by the check or wakes the worker up.
+     */
+    void park() {
+        std::unique_lock<std::mutex> lock(idleMutex);
+        ++sleepers;
+        idle.wait(lock, [this] {
+            return available.load() != 0 || outstanding.load() == 0;
+        });
+        --sleepers;
+    }
+
+    void wake() {
+        if (sleepers.load() == 0) return;
+        { std::lock_guard<std::mutex> lock(idleMutex); }
+        idle.notify_all();
+    }
+
+    /**
+     * @brief Claim a node for the workers if the budget allows it
+     * @details The bytes are those the workers recorded, not counting what
+     *          the target has already. The merge applies the exact budget.
+     */
+    bool queue(const Pending &p) {
+        return p.depth <= limits.max_depth &&
+               recorded.load() < limits.max_bytes && visited.insert(p.ds) &&
+               claimed++ < limits.max_nodes;
+    }
+
+    void show(Shard &shard, Task &t) {
+        shard.begin(&t);
+        t.item.show(t.item.ds, shard);
+        shard.end();
+        t.shown = true;
+        // as the target counts them, see Dot::addNode and Dot::addEdge
+        size_t bytes = 0;
+        for (auto &op : t.ops)
+            bytes += op.a.size() + op.b.size() + op.c.size() + 3;
+        recorded += bytes;
+    }
+
+    bool expired() const {
+        return deadline != std::chrono::steady_clock::time_point::max() &&
+               std::chrono::steady_clock::now() > deadline;
+    }
+
+    void merge(const std::vector<Pending> &roots) {
+        viz.startWalk();
+        mergeTasks(roots);
+        // an op still referring to a node without a name is dropped
+        for (auto &op : deferred)
+            apply(op, 0, nullptr);
+        deferred.clear();
+        viz.finishWalk();
+    }
+
+    void mergeTasks(const std::vector<Pending> &roots) {
+        std::vector<Task *> tasks(nextId);
+        PtrIndex            byDS;
+        for (auto &w : workers)
+            for (auto &t : w->tasks) {
+                tasks[t->id] = t.get();
+                if (t->shown) byDS.insert(t->item.ds, t->id);
+            }
+
+        if (!options.deterministic) {
+            // in the order the tasks were created, from the replayed ones
+            std::set<uint32_t>  ready;
+            std::deque<Pending> rest; // left out by the workers
+            auto                reach = [&](const Pending &p) {
+                uint32_t id = byDS.find(p.ds);
+                if (id != PtrIndex::npos)
+                    ready.insert(id);
+                else
+                    rest.push_back(p);
+            };
+            for (auto &r : roots)
+                reach(r);
+            while (!ready.empty()) {
+                Task &t = *tasks[*ready.begin()];
+                ready.erase(ready.begin());
+                if (t.replayed || !viz.claim(t.item.ds) ||
+                    !viz.admit(t.item.depth))
+                    continue;
+                replay(t);
+                for (auto &c : t.children)
+                    reach(c);
+            }
+            walk(std::move(rest), tasks, byDS);
+            return;
+        }
+        walk(std::deque<Pending>(roots.begin(), roots.end()), tasks, byDS);
+    }
+
+    /**
+     * @brief Walk the recorded children the same way IViz::visit would
+     * @details The nodes the workers showed in time are replayed whatever
+     *          the clock of the target says, since its walk only starts now.
+     *          A node they left out is shown here unless the deadline has
+     *          passed; claimed and not shown, it gets a stub.
+     */
+    void walk(std::deque<Pending> worklist, const std::vector<Task *> &tasks,
+              const PtrIndex &byDS) {
+        Order order = viz.getOrder();
+        while (!worklist.empty()) {
+            Pending p;
+            if (order == Order::DFS) {
+                p = worklist.back();
+                worklist.pop_back();
+            } else {
+                p = worklist.front();
+                worklist.pop_front();
+            }
+            if (!viz.claim(p.ds)) continue;
+            uint32_t id = byDS.find(p.ds);
+            if (id != PtrIndex::npos && tasks[id]->replayed) continue;
+            if (id == PtrIndex::npos && expired()) continue;
+            if (!viz.admit(p.depth)) continue;
+            Task *t = id != PtrIndex::npos ? tasks[id] : nullptr;
+            if (t == nullptr) {
+                // left out by the workers because of the budget
+                Shard shard(*this);
+                t = newTask(*workers[0], p);
+                show(shard, *t);
+            }
+            replay(*t);
+            for (auto &c : t->children)
+                c.depth = p.depth + 1;
+            if (order == Order::DFS)
+                worklist.insert(worklist.end(), t->children.rbegin(),
+                                t->children.rend());
+            else
+                worklist.insert(worklist.end(), t->children.begin(),
+                                t->children.end());
+        }
+    }
+
+    void replay(Task &t) {
+        t.replayed = true;
+        std::vector<std::string> names[3];
+        for (uint32_t i = 0; i < t.names[0]; ++i)
+            names[0].push_back(viz.genNodeName());
+        for (uint32_t i = 0; i < t.names[1]; ++i)
+            names[1].push_back(viz.genEdgeName());
+        for (uint32_t i = 0; i < t.names[2]; ++i)
+            names[2].push_back(viz.genPortName());
+
+        for (auto &op : t.ops)
+            if (!apply(op, t.id, names)) deferred.push_back(std::move(op));
+        std::vector<Op>().swap(t.ops);
+    }
+
+    /**
+     * @brief Replay one op into the target graph
+     * @details An edge to a node which has no name yet waits for it, the same
+     *          as in a serial walk. Any other op which refers to such a node
+     *          is left for later.
+     * @return False if the op could not be replayed yet
+     */
+    bool apply(Op &op, uint32_t task, const std::vector<std::string> *names) {
+        bool a = rewrite(op.a, task, names), b = rewrite(op.b, task, names),
+             c = rewrite(op.c, task, names);
+        if (op.kind == Op::AddEdge && a && !b && c) {
+            void *to = pointerOf(op.b);
+            if (to == nullptr) return false;
+            viz.addEdge(std::move(op.a), to, std::move(op.c));
+            return true;
+        }
+        if (!a || !b || !c) return false;
+        switch (op.kind) {
+        case Op::SetName: viz.setName(op.ds, std::move(op.a)); break;
+        case Op::AddNode: viz.addNode(std::move(op.a), std::move(op.b)); break;
+        case Op::AddEdge:
+            viz.addEdge(std::move(op.a), std::move(op.b), std::move(op.c));
+            break;
+        case Op::AddEdgeTo:
+            viz.addEdge(std::move(op.a), op.ds, std::move(op.c));
+            break;
+        case Op::AddSubGraph: viz.addSubGraph(std::move(op.a)); break;
+        }
+        return true;
+    }
+
+    /**
+     * @brief Replace the placeholders in `s`
+     * @details Only a well-formed placeholder of task `task`, or a reference,
+     *          is replaced, so a stray 0x1F in the text of a callback is kept
+     *          as it is. With no `names` the generated names are already
+     *          replaced. A reference to a node of another thread which has no
+     *          name in the target graph yet is left as it is.
+     * @return True if every placeholder was replaced
+     */
+    bool rewrite(std::string &s, uint32_t task,
+                 const std::vector<std::string> *names) {
+        size_t i = s.find('\x1f');
+        if (i == std::string::npos) return true;
+        bool        named = true;
+        std::string out(s, 0, i);
+        while (i != std::string::npos) {
+            uint64_t x, n;
+            size_t   end  = std::string::npos; // the closing 0x1F
+            char     kind = i + 1 < s.size() ? s[i + 1] : 0;
+            int      k    = kind == 'N' ? 0 : kind == 'E' ? 1 : kind == 'P' ? 2
+                                                                         : -1;
+            if (kind == 'R') {
+                size_t j = number(s, i + 2, 16, x);
+                if (j != i + 2 && j < s.size() && s[j] == '\x1f') {
+                    void *ds = (void *)(uintptr_t)x;
+                    if (viz.hasNode(ds))
+                        out += viz.getName(ds);
+                    else {
+                        out.append(s, i, j - i + 1);
+                        named = false;
+                    }
+                    end = j;
+                }
+            } else if (k >= 0 && names) {
+                size_t j = number(s, i + 2, 10, x), m = j + 1;
+                if (j != i + 2 && x == task && j < s.size() && s[j] == '.')
+                    m = number(s, j + 1, 10, n);
+                if (m != j + 1 && m < s.size() && s[m] == '\x1f' &&
+                    n < names[k].size()) {
+                    out += names[k][n];
+                    end = m;
+                }
+            }
+            if (end == std::string::npos) {
+                out += '\x1f';
+                end = i;
+            }
+            i = s.find('\x1f', end + 1);
+            out.append(s, end + 1,
+                       (i == std::string::npos ? s.size() : i) - end - 1);
+        }
+        s = std::move(out);
+        return named;
+    }
+
+    // the node of a name which is just a reference, or nullptr
+    static void *pointerOf(const std::string &s) {
+        uint64_t x;
+        if (s.size() < 4 || s[0] != '\x1f' || s[1] != 'R') return nullptr;
+        size_t j = number(s, 2, 16, x);
+        if (j == 2 || j == s.size() || s[j] != '\x1f') return nullptr;
+        if (j + 1 != s.size() && s[j + 1] != ':') return nullptr;
+        return (void *)(uintptr_t)x;
+    }
+
+    // reads the digits at `s[i]`, returning the position after them
+    static size_t number(const std::string &s, size_t i, int base,
+                         uint64_t &x) {
+        x = 0;
+        for (; i < s.size(); ++i) {
+            char c = s[i];
+            int  d = c >= '0' && c <= '9'   ? c - '0'
+                     : base == 16 && c >= 'a' && c <= 'f' ? c - 'a' + 10
+                                                          : -1;
+            if (d < 0) break;
+            x = x * base + d;
+        }
+        return i;
+    }
+
+    IViz                                &viz;
+    ParallelOptions                      options;
+    ConcurrentPtrSet                     visited;
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::atomic<uint32_t>                nextId{0};
+    std::atomic<size_t>                  outstanding{0};
+    std::atomic<size_t>                  available{0}; // tasks in the queues
+    std::atomic<unsigned>                sleepers{0};  // workers in park
+    std::mutex                           idleMutex;
+    std::condition_variable              idle;
+    std::atomic<size_t>                  claimed{0};  // by the workers
+    std::atomic<size_t>                  recorded{0}; // bytes, see show
+    std::chrono::steady_clock::time_point deadline;
+    Budget                               limits;     // of the target
+    std::vector<Op>                      deferred;   // see apply
+};
+
+
+/**
+ * @brief Hooks which let a walk read a structure that other threads change
+ * @details `enter` and `leave` wrap the whole walk in a read-side section,
+ *          such as pinning an epoch or `rcu_read_lock`, so that no node the
+ *          walk can reach is freed before it ends. `begin` and `validate`
+ *          wrap each `dsviz_show`: the node is shown again if `validate`
+ *          finds that it changed since `begin`. Writers are never waited
+ *          for. Each hook gets the pointer passed to `load_ds` or
+ *          `load_ds_c`, or for a `Mock` the original pointer it stands for.
+ */
+class ReadGuard {
+  public:
+    virtual ~ReadGuard() {}
+
+    virtual void enter() {}
+    virtual void leave() {}
+
+    /**
+     * @brief Start reading a node
+     * @return The version of the node, passed back to `validate`
+     */
+    virtual uint64_t begin(void *ds) {
+        (void)ds;
+        return 0;
+    }
+
+    /**
+     * @return True if the node did not change since `begin` returned
+     *         `version`
+     */
+    virtual bool validate(void *ds, uint64_t version) {
+        (void)ds;
+        (void)version;
+        return true;
+    }
+};
+
+/**
+ * @brief A `ReadGuard` for nodes of type T with a sequence counter
+ * @details The writers of a node make the counter odd while they change it
+ *          and even again afterwards. A node read while the counter was odd
+ *          or which has a different counter after `dsviz_show` is read again.
+ *          The fields read by `dsviz_show` should be atomics or read with
+ *          relaxed loads, as with any seqlock.
+ */
+template <class T, class S = uint32_t> class SeqlockGuard : public ReadGuard {
+  public:
+    explicit SeqlockGuard(std::atomic<S> T::*seq) : seq(seq) {}
+
+    virtual uint64_t begin(void *ds) override {
+        return (static_cast<T *>(ds)->*seq).load(std::memory_order_acquire);
+    }
+
+    virtual bool validate(void *ds, uint64_t version) override {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return version % 2 == 0 &&
+               (static_cast<T *>(ds)->*seq).load(std::memory_order_relaxed) ==
+                   version;
+    }
+
+  private:
+    std::atomic<S> T::*seq;
+};
+
+/**
+ * @brief Options of `ConsistentWalker`
+ */
+struct ConsistentOptions {
+    // times a changed node is shown again before it is kept as it is
+    unsigned retries = 3;
+    // attributes added to the nodes which kept changing
+    std::string mark = "color=red xlabel=\"changed\"";
+};
+
+/**
+ * @brief How many nodes a `ConsistentWalker` had to read again
+ */
+struct Consistency {
+    size_t nodes        = 0; // nodes shown
+    size_t rereads      = 0; // dsviz_show calls which were thrown away
+    size_t inconsistent = 0; // nodes marked after running out of retries
+
+    /**
+     * @brief Print the counts as a dot comment
+     */
+    std::string comment() const {
+        std::stringstream ss;
+        ss << "// dsviz consistency: nodes=" << nodes
+           << " rereads=" << rereads << " inconsistent=" << inconsistent
+           << "\n";
+        return ss.str();
+    }
+};
+
+/**
+ * @brief Loads a data structure which is changed by other threads
+ * @details Each `dsviz_show` runs against a scratch graph between
+ *          `ReadGuard::begin` and `ReadGuard::validate`. Only a node that
+ *          validates is added to the target graph, together with the nodes
+ *          it reached; one that changed is shown again, up to `retries`
+ *          times, and then added with the `mark` attributes. The walk
+ *          follows the order and the budget of the target graph.
+ *
+ *          Table nodes format their own labels, a `recorder` of the target
+ *          is not used.
+ */
+class ConsistentWalker {
+  public:
+    ConsistentWalker(IViz &viz, ReadGuard &guard,
+                     ConsistentOptions options = {})
+        : viz(viz), guard(guard), options(options), scratch(*this) {}
+
+    /**
+     * @brief Load a data structure to the graph
+     * @param ds The pointer to the data structure
+     */
+    void load_ds(IDataStructure *ds) {
+        scratch.load_ds(ds);
+        walk();
+    }
+
+    /**
+     * @brief Load a data structure shown by `dsviz_show(T*, IViz&)`
+     * @param ds The pointer to the data structure
+     */
+    template <class T> void load_ds_c(T *ds) {
+        scratch.load_ds_c(ds);
+        walk();
+    }
+
+    /**
+     * @brief The counts of all walks so far
+     */
+    const Consistency &report() const { return counts; }
+
+  private:
+    typedef IViz::Pending Pending;
+
+    /**
+     * @brief A call made by a callback, added to the target once it validates
+     */
+    struct Op {
+        enum Kind { SetName, AddNode, AddEdge, AddEdgeTo, AddSubGraph };
+        Kind                     kind;
+        void                    *ds;
+        std::string              a, b, c;
+        std::unique_ptr<Cluster> cluster; // for AddSubGraph, or text in a
+    };
+
+    /**
+     * @brief The graph one `dsviz_show` call writes to
+     * @details Names are generated by the target, so a node shown again
+     *          leaves gaps in the numbering.
+     */
+    class Scratch : public IViz {
+      public:
+        explicit Scratch(ConsistentWalker &w) : w(w) { walking = true; }
+
+        void clear() {
+            ops.clear();
+            children.clear();
+            local.clear();
+            localNames.clear();
+        }
+
+        virtual std::string print() const override { return std::string(); }
+
+        virtual std::string genNodeName() override {
+            return w.viz.genNodeName();
+        }
+        virtual std::string genEdgeName() override {
+            return w.viz.genEdgeName();
+        }
+        virtual std::string genPortName() override {
+            return w.viz.genPortName();
+        }
+
+        using IViz::addEdge;
+        virtual void addEdge(std::string from, std::string to,
+                             std::string edge = "") override {
+            record(Op::AddEdge, nullptr, from, to, edge);
+        }
+        virtual void addEdge(std::string from, void *to,
+                             std::string edge = "") override {
+            record(Op::AddEdgeTo, to, from, "", edge);
+        }
+
+        virtual void addNode(std::string name, std::string node) override {
+            record(Op::AddNode, nullptr, name, node, "");
+        }
+        virtual void addSubGraph(std::string sg) override {
+            record(Op::AddSubGraph, nullptr, sg, "", "");
+        }
+        virtual void addCluster(std::unique_ptr<Cluster> cluster) override {
+            record(Op::AddSubGraph, nullptr, "", "", "");
+            ops.back().cluster = std::move(cluster);
+        }
+
+        virtual void setName(void *ds, std::string name) override {
+            uint32_t id = local.insert(ds, (uint32_t)localNames.size());
+            if (id == localNames.size())
+                localNames.push_back(std::make_pair(ds, name));
+            else
+                localNames[id].second = name;
+            record(Op::SetName, ds, name, "", "");
+        }
+
+        virtual std::string getName(void *ds) const override {
+            uint32_t id = local.find(ds);
+            if (id != PtrIndex::npos) return localNames[id].second;
+            return w.viz.getName(ds);
+        }
+
+        virtual void *getDS(std::string name) const override {
+            for (auto &p : localNames)
+                if (p.second == name) return p.first;
+            return w.viz.getDS(name);
+        }
+
+        virtual bool hasNode(void *ds) const override {
+            return local.find(ds) != PtrIndex::npos || w.viz.hasNode(ds);
+        }
+
+        virtual const Summary &summary() const override {
+            return w.viz.summary();
+        }
+
+      private:
+        friend class ConsistentWalker;
+
+        void record(Op::Kind kind, void *ds, std::string a, std::string b,
+                    std::string c) {
+            ops.push_back(Op());
+            Op &op  = ops.back();
+            op.kind = kind;
+            op.ds   = ds;
+            op.a    = std::move(a);
+            op.b    = std::move(b);
+            op.c    = std::move(c);
+        }
+
+        ConsistentWalker                           &w;
+        std::vector<Op>                             ops;
+        PtrIndex                                    local;
+        std::vector<std::pair<void *, std::string>> localNames;
+    };
+
+    void walk() {
+        std::deque<Pending> worklist(scratch.children.begin(),
+                                     scratch.children.end());
+        scratch.clear();
+        guard.enter();
+        viz.startWalk();
+        Order order = viz.getOrder();
+        while (!worklist.empty()) {
+            Pending p;
+            if (order == Order::DFS) {
+                p = worklist.back();
+                worklist.pop_back();
+            } else {
+                p = worklist.front();
+                worklist.pop_front();
+            }
+            if (!viz.claim(p.ds)) continue;
+            if (!viz.admit(p.depth)) continue;
+            show(p);
+            for (auto &c : scratch.children)
+                c.depth = p.depth + 1;
+            // reversed for DFS, as in IViz::visit
+            if (order == Order::DFS)
+                worklist.insert(worklist.end(), scratch.children.rbegin(),
+                                scratch.children.rend());
+            else
+                worklist.insert(worklist.end(), scratch.children.begin(),
+                                scratch.children.end());
+            scratch.clear();
+        }
+        viz.finishWalk();
+        guard.leave();
+    }
+
+    // the pointer the guard reads, which is the original one for a Mock
+    static void *guarded(const Pending &p) {
+        if (p.show != &IViz::showDS) return p.ds;
+        auto m = dynamic_cast<MockBase *>(static_cast<IDataStructure *>(p.ds));
+        return m ? m->target() : p.ds;
+    }
+
+    // show a node until it validates, and add the last attempt to the target
+    void show(const Pending &p) {
+        bool  valid = false;
+        void *read  = guarded(p);
+        for (unsigned n = 0;; ++n) {
+            uint64_t version = guard.begin(read);
+            p.show(p.ds, scratch);
+            valid = guard.validate(read, version);
+            if (valid || n == options.retries) break;
+            ++counts.rereads;
+            scratch.clear();
+        }
+        ++counts.nodes;
+        if (!valid) ++counts.inconsistent;
+
+        for (auto &op : scratch.ops) {
+            switch (op.kind) {
+            case Op::SetName: viz.setName(op.ds, std::move(op.a)); break;
+            case Op::AddNode:
+                if (!valid) mark(op.b);
+                viz.addNode(std::move(op.a), std::move(op.b));
+                break;
+            case Op::AddEdge:
+                viz.addEdge(std::move(op.a), std::move(op.b), std::move(op.c));
+                break;
+            case Op::AddEdgeTo:
+                viz.addEdge(std::move(op.a), op.ds, std::move(op.c));
+                break;
+            case Op::AddSubGraph:
+                if (op.cluster)
+                    viz.addCluster(std::move(op.cluster));
+                else
+                    viz.addSubGraph(std::move(op.a));
+                break;
+            }
+        }
+    }
+
+    void mark(std::string &node) const {
+        if (options.mark.empty()) return;
+        size_t end = node.rfind(']');
+        if (end == std::string::npos)
+            node += " [" + options.mark + "]";
+        else
+            node.insert(end, " " + options.mark);
+    }
+
+    IViz             &viz;
+    ReadGuard        &guard;
+    ConsistentOptions options;
+    Consistency       counts;
+    Scratch           scratch;
+};
+
+
+/**
+ * @brief The shape of a data structure, measured by `ShapeStats`
+ */
+struct Shape {
+    size_t nodes  = 0; // nodes shown
+    size_t edges  = 0; // edges between shown nodes
+    size_t shared = 0; // nodes with more than one edge in
+    size_t cycles = 0; // edges closing a cycle, the back edges of a DFS
+
+    std::vector<size_t>           depths; // nodes at each distance from a root
+    std::vector<size_t>           fanout; // nodes with each number of edges out
+    std::map<std::string, size_t> types;  // nodes of each type
+
+    size_t height() const { return depths.size(); }
+
+    /**
+     * @brief Print the shape as dot comments
+     */
+    std::string comment() const {
+        std::stringstream ss;
+        ss << "// dsviz shape: nodes=" << nodes << " edges=" << edges
+           << " shared=" << shared << " cycles=" << cycles
+           << " height=" << height() << "\n";
+        ss << "// dsviz depths:";
+        for (size_t d : depths) ss << " " << d;
+        ss << "\n// dsviz fanout:";
+        for (size_t f : fanout) ss << " " << f;
+        ss << "\n";
+        for (auto &t : types)
+            ss << "// dsviz type " << t.first << ": nodes=" << t.second << "\n";
+        return ss.str();
+    }
+
+    std::string json() const {
+        std::stringstream ss;
+        ss << "{\"nodes\":" << nodes << ",\"edges\":" << edges
+           << ",\"shared\":" << shared << ",\"cycles\":" << cycles
+           << ",\"height\":" << height() << ",\"depths\":[";
+        for (size_t i = 0; i < depths.size(); ++i)
+            ss << (i ? "," : "") << depths[i];
+        ss << "],\"fanout\":[";
+        for (size_t i = 0; i < fanout.size(); ++i)
+            ss << (i ? "," : "") << fanout[i];
+        ss << "],\"types\":{";
+        bool first = true;
+        for (auto &t : types) {
+            std::string name;
+            jsonQuote(name, t.first);
+            ss << (first ? "" : ",") << name << ":" << t.second;
+            first = false;
+        }
+        ss << "}}";
+        return ss.str();
+    }
+};
+
+/**
+ * @brief A graph which only measures the shape of what is loaded into it
+ * @details The `dsviz_show` callbacks and the traversal of `load_ds` run as
+ *          usual, but table nodes send their rows to a recorder which drops
+ *          them, and nothing is kept but the nodes, the edges between them
+ *          and the type of each node. Port names are not numbered. Edges
+ *          added inside a `SubGraph` are not seen.
+ */
+class ShapeStats : public IViz {
+  public:
+    ShapeStats() { typed = true; }
+
+    /**
+     * @brief Forget everything loaded so far
+     */
+    void clear() {
+        index.clear();
+        entries.clear();
+        byNumber.clear();
+        customNames.clear();
+        customIds.clear();
+        byCustomName.clear();
+        links.clear();
+        roots.clear();
+        count0 = count1 = 0;
+    }
+
+    /**
+     * @brief Measure everything loaded so far
+     */
+    Shape shape() const {
+        const uint32_t npos = PtrIndex::npos;
+        Shape          r;
+        size_t         n = entries.size();
+        for (auto &e : entries)
+            if (e.shown) ++r.nodes;
+
+        // the edges between shown nodes, grouped by source
+        std::vector<uint32_t> start(n + 1), in(n), to;
+        std::vector<std::pair<uint32_t, uint32_t>> es;
+        es.reserve(links.size());
+        for (auto &l : links) {
+            uint32_t a = resolve(l.from), b = resolve(l.to);
+            if (a == npos || b == npos) continue;
+            es.push_back(std::make_pair(a, b));
+            ++start[a + 1];
+            ++in[b];
+        }
+        for (size_t i = 0; i < n; ++i)
+            start[i + 1] += start[i];
+        to.resize(es.size());
+        std::vector<uint32_t> fill(start.begin(), start.end() - 1);
+        for (auto &e : es)
+            to[fill[e.first]++] = e.second;
+        r.edges = es.size();
+
+        std::map<uint32_t, size_t> types;
+        for (uint32_t i = 0; i < n; ++i) {
+            if (!entries[i].shown) continue;
+            size_t out = start[i + 1] - start[i];
+            if (r.fanout.size() <= out) r.fanout.resize(out + 1);
+            ++r.fanout[out];
+            if (in[i] > 1) ++r.shared;
+            ++types[entries[i].type];
+        }
+        for (auto &t : types)
+            r.types[t.first == npos ? "unknown" : typeName(*typeList[t.first])] +=
+                t.second;
+
+        // depths by BFS from the roots, then from the nodes they miss
+        std::vector<uint32_t> depth(n, npos);
+        std::deque<uint32_t>  queue;
+        auto                  bfs = [&](uint32_t root) {
+            if (!entries[root].shown || depth[root] != npos) return;
+            depth[root] = 0;
+            queue.push_back(root);
+            while (!queue.empty()) {
+                uint32_t i = queue.front();
+                queue.pop_front();
+                if (r.depths.size() <= depth[i]) r.depths.resize(depth[i] + 1);
+                ++r.depths[depth[i]];
+                for (uint32_t k = start[i]; k < start[i + 1]; ++k) {
+                    if (depth[to[k]] != npos) continue;
+                    depth[to[k]] = depth[i] + 1;
+                    queue.push_back(to[k]);
+                }
+            }
+        };
+        for (uint32_t root : roots)
+            bfs(root);
+        for (uint32_t i = 0; i < n; ++i)
+            bfs(i);
+
+        // an edge to a node still on the DFS stack closes a cycle
+        std::vector<uint8_t>                       state(n);
+        std::vector<std::pair<uint32_t, uint32_t>> stack;
+        for (uint32_t root = 0; root < n; ++root) {
+            if (state[root] != 0) continue;
+            state[root] = 1;
+            stack.push_back(std::make_pair(root, start[root]));
+            while (!stack.empty()) {
+                uint32_t i = stack.back().first;
+                if (stack.back().second == start[i + 1]) {
+                    state[i] = 2;
+                    stack.pop_back();
+                    continue;
+                }
+                uint32_t d = to[stack.back().second++];
+                if (state[d] == 1) ++r.cycles;
+                if (state[d] != 0) continue;
+                state[d] = 1;
+                stack.push_back(std::make_pair(d, start[d]));
+            }
+        }
+        return r;
+    }
+
+    /**
+     * @brief The shape as dot comments, no nodes are printed
+     */
+    virtual std::string print() const override { return shape().comment(); }
+
+    virtual std::string genNodeName() override {
+        return "_node" + std::to_string(count0++);
+    }
+    virtual std::string genEdgeName() override {
+        return "_edge" + std::to_string(count1++);
+    }
+    virtual std::string genPortName() override { return "_port"; }
+
+    using IViz::addEdge;
+    virtual void addEdge(std::string from, std::string to,
+                         std::string edge = "") override {
+        (void)edge;
+        links.push_back(Link{end(from), end(to)});
+    }
+    virtual void addEdge(std::string from, void *to,
+                         std::string edge = "") override {
+        (void)edge;
+        links.push_back(Link{end(from), End{End::Pointer, entryOf(to)}});
+    }
+
+    virtual void addNode(std::string, std::string) override {}
+    virtual void addSubGraph(std::string) override {}
+    virtual void addCluster(std::unique_ptr<Cluster>) override {}
+
+    virtual void setName(void *ds, std::string name) override {
+        uint32_t id    = entryOf(ds);
+        Entry   &e     = entries[id];
+        e.shown        = true;
+        e.name         = end(name);
+        if (e.name.kind == End::Numbered) {
+            if (byNumber.size() <= e.name.id)
+                byNumber.resize(e.name.id + 1, PtrIndex::npos);
+            byNumber[e.name.id] = id;
+        } else {
+            byCustomName[e.name.id] = id;
+        }
+    }
+
+    virtual std::string getName(void *ds) const override {
+        assert(hasNode(ds));
+        const End &name = entries[index.find(ds)].name;
+        if (name.kind == End::Numbered)
+            return "_node" + std::to_string(name.id);
+        return customNames[name.id];
+    }
+
+    virtual void *getDS(std::string name) const override {
+        End e = {End::Numbered, 0};
+        if (!numbered(name, name.size(), e.id)) {
+            auto it = customIds.find(name);
+            if (it == customIds.end()) return nullptr;
+            e = End{End::Custom, it->second};
+        }
+        uint32_t id = resolve(e);
+        return id == PtrIndex::npos ? nullptr : entries[id].ds;
+    }
+
+    virtual bool hasNode(void *ds) const override {
+        uint32_t id = index.find(ds);
+        return id != PtrIndex::npos && entries[id].shown;
+    }
+
+    virtual Recorder *recorder() override { return &dropped; }
+
+  protected:
+    virtual void reached(void *ds, const std::type_info &type) override {
+        uint32_t id = entryOf(ds);
+        auto     it = typeIds.emplace(std::type_index(type),
+                                      (uint32_t)typeList.size());
+        if (it.second) typeList.push_back(&type);
+        entries[id].type = it.first->second;
+        if (!walking) roots.push_back(id);
+    }
+
+  private:
+    /**
+     * @brief A node named `_nodeN`, by another name, or by its pointer
+     */
+    struct End {
+        enum Kind : uint8_t { Numbered, Custom, Pointer };
+        Kind     kind;
+        uint32_t id;
+    };
+
+    struct Link {
+        End from, to;
+    };
+
+    struct Entry {
+        void    *ds;
+        uint32_t type  = PtrIndex::npos;
+        End      name  = {End::Custom, PtrIndex::npos};
+        bool     shown = false;
+    };
+
+    uint32_t entryOf(void *ds) {
+        uint32_t id = index.insert(ds, (uint32_t)entries.size());
+        if (id == entries.size()) {
+            entries.push_back(Entry());
+            entries.back().ds = ds;
+        }
+        return id;
+    }
+
+    // the node part of `name[:port]`
+    End end(const std::string &name) {
+        size_t   colon = std::min(name.find(':'), name.size());
+        uint32_t n;
+        if (numbered(name, colon, n)) return End{End::Numbered, n};
+        auto it = customIds.emplace(name.substr(0, colon),
+                                    (uint32_t)customNames.size());
+        if (it.second) customNames.push_back(it.first->first);
+        return End{End::Custom, it.first->second};
+    }
+
+    // true if `name` is `_nodeN` up to `size`
+    static bool numbered(const std::string &name, size_t size, uint32_t &n) {
+        if (size < 6 || size > 15 || name.compare(0, 5, "_node") != 0)
+            return false;
+        uint64_t v = 0;
+        for (size_t i = 5; i < size; ++i) {
+            if (name[i] < '0' || name[i] > '9') return false;
+            v = v * 10 + (name[i] - '0');
+        }
+        if (v >= PtrIndex::npos) return false;
+        n = (uint32_t)v;
+        return true;
+    }
+
+    // the shown entry an end refers to, or npos
+    uint32_t resolve(const End &e) const {
+        uint32_t id = PtrIndex::npos;
+        if (e.kind == End::Pointer) {
+            id = e.id;
+        } else if (e.kind == End::Numbered) {
+            if (e.id < byNumber.size()) id = byNumber[e.id];
+        } else {
+            auto it = byCustomName.find(e.id);
+            if (it != byCustomName.end()) id = it->second;
+        }
+        return id != PtrIndex::npos && entries[id].shown ? id
+                                                         : PtrIndex::npos;
+    }
+
+    int count0 = 0, count1 = 0;
+
+    PtrIndex                                      index;
+    std::vector<Entry>                            entries;
+    std::vector<uint32_t>                         byNumber;
+    std::vector<std::string>                      customNames;
+    std::unordered_map<std::string, uint32_t>     customIds;
+    std::unordered_map<uint32_t, uint32_t>        byCustomName;
+    std::vector<Link>                             links;
+    std::vector<uint32_t>                         roots;
+    std::vector<const std::type_info *>           typeList;
+    std::unordered_map<std::type_index, uint32_t> typeIds;
+    NullRecorder                                  dropped;
+};
+
+
+/**
+ * @brief Shows a large structure a part at a time, as a viewer asks for it
+ * @details Only the roots are visible at first. `expand` shows the nodes
+ *          within some depth of a node, and `page` shows a range of a node's
+ *          children. Every node that has children which are not visible
+ *          gets a stub `… N more`.
+ *
+ *          A node is shown by its `dsviz_show` the first time it is needed,
+ *          without following its children, and what it added is cached with
+ *          the name it was given. Asking for it again costs nothing, and its
+ *          name stays the same for the lifetime of the explorer. While a
+ *          node is shown, `hasNode` only knows the node itself, and
+ *          `Mock::get` uses the explorer's own `MockScope`.
+ *
+ *          `request` takes text commands, so a debugger can drive it by
+ *          evaluating a function call, and `serve` answers them on a pipe:
+ *
+ *              view                          the visible graph
+ *              expand <node> <depth>         show the nodes within depth
+ *              page <node> <offset> <count>  show some children of a node
+ *              reset                         hide everything but the roots
+ */
+class Explorer {
+  public:
+    Explorer(Config config = {}) : config(config), scratch(*this) {}
+
+    /**
+     * @brief Add a root, which is always visible
+     */
+    void load_ds(IDataStructure *ds) {
+        scratch.load_ds(ds);
+        addRoots();
+    }
+
+    template <class T> void load_ds_c(T *ds) {
+        scratch.load_ds_c(ds);
+        addRoots();
+    }
+
+    /**
+     * @brief Make the nodes within `depth` edges of a node visible
+     * @return False if no node has that name
+     */
+    bool expand(const std::string &node, unsigned depth) {
+        auto it = byName.find(node);
+        if (it == byName.end()) return false;
+        std::vector<uint32_t>        level(1, it->second), next, children;
+        std::unordered_set<uint32_t> reached(level.begin(), level.end());
+        for (unsigned d = 0; d < depth && !level.empty(); ++d) {
+            for (uint32_t i : level) {
+                show(i);
+                // showing a child may move the entries
+                children = entries[i].children;
+                for (uint32_t c : children) {
+                    reveal(c);
+                    if (reached.insert(c).second) next.push_back(c);
+                }
+            }
+            level.swap(next);
+            next.clear();
+        }
+        return true;
+    }
+
+    /**
+     * @brief Make the children `offset` to `offset + count` of a node visible
+     * @return False if no node has that name
+     */
+    bool page(const std::string &node, size_t offset, size_t count) {
+        auto it = byName.find(node);
+        if (it == byName.end()) return false;
+        show(it->second);
+        std::vector<uint32_t> children = entries[it->second].children;
+        for (size_t i = offset; i < children.size() && i - offset < count; ++i)
+            reveal(children[i]);
+        return true;
+    }
+
+    /**
+     * @brief The scope of the mock objects of the nodes shown on demand
+     * @details It lives as long as the explorer. Bind it with
+     *          `MockScope::Bind` to get the mock objects of the roots too.
+     */
+    MockScope &mocks() { return scope; }
+
+    /**
+     * @brief Hide every node but the roots
+     */
+    void reset() {
+        for (uint32_t i : visible)
+            entries[i].visible = false;
+        visible.clear();
+        for (uint32_t r : roots)
+            reveal(r);
+    }
+
+    /**
+     * @brief Render the visible nodes
+     */
+    std::string print() const {
+        Dot dot(config);
+        render(dot);
+        return dot.print();
+    }
+
+    /**
+     * @brief Run a command and render the visible nodes into `buf`
+     * @return The graph, or a dot comment starting with `// dsviz error:`
+     */
+    Output request(StrRef line, std::string &buf) {
+        std::istringstream in(line.str());
+        std::string        cmd, node;
+        size_t             a = 0, b = 0;
+        in >> cmd;
+        bool ok = true;
+        if (cmd == "expand") {
+            ok = bool(in >> node >> a) && expand(node, (unsigned)a);
+        } else if (cmd == "page") {
+            ok = bool(in >> node >> a >> b) && page(node, a, b);
+        } else if (cmd == "reset") {
+            reset();
+        } else if (cmd != "view") {
+            ok = false;
+        }
+        if (!ok) {
+            buf = "// dsviz error: " + line.str() + "\n";
+            return Output{buf.data(), buf.size()};
+        }
+        Dot dot(config);
+        render(dot);
+        return dot.print(buf);
+    }
+
+#ifdef DSVIZ_HAS_FD
+    /**
+     * @brief Answer the commands read from `in`, one per line, until it ends
+     * @details Each answer is written to `out` as its length in decimal and a
+     *          newline, followed by the graph.
+     */
+    void serve(int in, int out) {
+        FdBuf        outbuf(out);
+        std::ostream os(&outbuf);
+        std::string  pending, buf;
+        char         chunk[4096];
+        while (true) {
+            ssize_t n = ::read(in, chunk, sizeof chunk);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return;
+            pending.append(chunk, (size_t)n);
+            size_t start = 0;
+            for (size_t nl; (nl = pending.find('\n', start)) !=
+                            std::string::npos;
+                 start = nl + 1) {
+                Output r =
+                    request(StrRef(pending.data() + start, nl - start), buf);
+                os << r.size << "\n";
+                os.write(r.data, (std::streamsize)r.size);
+            }
+            pending.erase(0, start);
+            os.flush();
+        }
+    }
+#endif
+
+  private:
+    typedef IViz::ShowFn ShowFn;
+
+    struct Link {
+        std::string from, attr;
+        uint32_t    to;     // an entry, or npos for `toName`
+        std::string toName; // an edge between names
+    };
+
+    struct Entry {
+        void       *ds;
+        ShowFn      show    = nullptr;
+        bool        shown   = false;
+        bool        visible = false;
+        std::string name; // given by setName when shown
+
+        std::vector<std::pair<std::string, std::string>> nodes;
+        std::vector<std::string>                         subgraphs;
+        std::vector<Link>                                links;
+        std::vector<uint32_t>                            children;
+    };
+
+    /**
+     * @brief The graph a node is shown into, adding to its entry
+     */
+    class Scratch : public IViz {
+      public:
+        explicit Scratch(Explorer &x) : x(x) { walking = true; }
+
+        virtual std::string print() const override { return std::string(); }
+
+        virtual std::string genNodeName() override {
+            return "_node" + std::to_string(x.count0++);
+        }
+        virtual std::string genEdgeName() override {
+            return "_edge" + std::to_string(x.count1++);
+        }
+        virtual std::string genPortName() override {
+            return "_port" + std::to_string(x.count2++);
+        }
+
+        using IViz::addEdge;
+        virtual void addEdge(std::string from, std::string to,
+                             std::string edge = "") override {
+            x.entries[current].links.push_back(
+                Link{std::move(from), std::move(edge), PtrIndex::npos,
+                     std::move(to)});
+        }
+        virtual void addEdge(std::string from, void *to,
+                             std::string edge = "") override {
+            uint32_t id = x.entryOf(to);
+            x.entries[current].links.push_back(
+                Link{std::move(from), std::move(edge), id, std::string()});
+            if (child(to)) x.entries[current].children.push_back(id);
+        }
+
+        virtual void addNode(std::string name, std::string node) override {
+            x.entries[current].nodes.push_back(
+                std::make_pair(std::move(name), std::move(node)));
+        }
+        virtual void addSubGraph(std::string sg) override {
+            x.entries[current].subgraphs.push_back(std::move(sg));
+        }
+
+        virtual void setName(void *ds, std::string name) override {
+            uint32_t id     = x.entryOf(ds);
+            x.byName[name]  = id;
+            x.entries[id].name = std::move(name);
+        }
+
+        virtual std::string getName(void *ds) const override {
+            uint32_t id = x.index.find(ds);
+            assert(id != PtrIndex::npos && !x.entries[id].name.empty());
+            return x.entries[id].name;
+        }
+
+        virtual void *getDS(std::string name) const override {
+            auto it = x.byName.find(name);
+            return it == x.byName.end() ? nullptr : x.entries[it->second].ds;
+        }
+
+        virtual bool hasNode(void *ds) const override {
+            return current != PtrIndex::npos &&
+                   ds == x.entries[current].ds &&
+                   !x.entries[current].name.empty();
+        }
+
+      private:
+        friend class Explorer;
+
+        // true the first time a child of the current node is seen
+        bool child(void *ds) {
+            size_t before = seen.size();
+            seen.insert(ds, 0);
+            return seen.size() != before;
+        }
+
+        Explorer &x;
+        uint32_t  current = PtrIndex::npos;
+        PtrIndex  seen; // children of the current node
+    };
+
+    uint32_t entryOf(void *ds) {
+        uint32_t id = index.insert(ds, (uint32_t)entries.size());
+        if (id == entries.size()) {
+            entries.push_back(Entry());
+            entries.back().ds = ds;
+        }
+        return id;
+    }
+
+    // learn how to show the pointers queued by the last dsviz_show
+    std::vector<uint32_t> queued() {
+        std::vector<uint32_t> ids;
+        for (auto &p : scratch.children) {
+            uint32_t id = entryOf(p.ds);
+            if (!entries[id].show) entries[id].show = p.show;
+            ids.push_back(id);
+        }
+        scratch.children.clear();
+        return ids;
+    }
+
+    void addRoots() {
+        for (uint32_t id : queued()) {
+            if (std::find(roots.begin(), roots.end(), id) != roots.end())
+                continue;
+            roots.push_back(id);
+            reveal(id);
+        }
+    }
+
+    void show(uint32_t id) {
+        if (entries[id].shown || !entries[id].show) return;
+        entries[id].shown = true;
+        scratch.current   = id;
+        scratch.seen.clear();
+        scratch.child(entries[id].ds);
+        MockScope::Bind bind(scope);
+        entries[id].show(entries[id].ds, scratch);
+        for (uint32_t c : queued())
+            if (scratch.child(entries[c].ds)) entries[id].children.push_back(c);
+        scratch.current = PtrIndex::npos;
+    }
+
+    // show a node and make it visible, true if it was hidden
+    bool reveal(uint32_t id) {
+        show(id);
+        if (!entries[id].shown || entries[id].visible) return false;
+        entries[id].visible = true;
+        visible.push_back(id);
+        return true;
+    }
+
+    void render(Dot &dot) const {
+        for (uint32_t id : visible) {
+            const Entry &e = entries[id];
+            for (auto &n : e.nodes)
+                dot.addNode(n.first, n.second);
+            for (auto &sg : e.subgraphs)
+                dot.addSubGraph(sg);
+
+            size_t hidden = 0;
+            for (uint32_t c : e.children)
+                if (!entries[c].visible) ++hidden;
+            std::string stub = e.name + "_more";
+            if (hidden)
+                dot.addNode(stub, "[label=\"\xe2\x80\xa6 " +
+                                      std::to_string(hidden) +
+                                      " more\" shape=box style=dashed]");
+            for (auto &l : e.links) {
+                if (l.to == PtrIndex::npos)
+                    dot.addEdge(l.from, l.toName, l.attr);
+                else if (entries[l.to].visible)
+                    dot.addEdge(l.from, entries[l.to].name, l.attr);
+                else if (hidden)
+                    dot.addEdge(l.from, stub, l.attr);
+            }
+        }
+    }
+
+    Config    config;
+    Scratch   scratch;
+    MockScope scope{MockScope::Unbound()};
+    int       count0 = 0, count1 = 0, count2 = 0;
+    PtrIndex  index;
+
+    std::vector<Entry>                        entries;
+    std::unordered_map<std::string, uint32_t> byName;
+    std::vector<uint32_t>                     roots;
+    std::vector<uint32_t>                     visible; // in the order shown
 };
 
 
@@ -1,6 +1,5 @@
 
 #include <iostream>
-#include <cstring>
 
 using namespace std;
 
@@ -76,17 +75,30 @@ void dsviz_show(bintree_node* P, DSViz::IViz &viz) {
     if (P->right) node.addEdge(mock::get(P->right), "right");
 }
 
-const char* _dotToDebugger(bst& b) {
-    if (!b.getRoot()) return "";
-    
+DSViz::Output _dotToDebugger(bst& b) {
+    static string buffer;
+    if (!b.getRoot()) return DSViz::Output{"", 0};
+
+    DSViz::MockScope scope;
     auto* root = mock::get(b.getRoot());
     DSViz::Dot dot;
     dot.load_ds(root);
-    string str = dot.print();
+    return dot.print(buffer);
+}
 
-    static char cstr[1024 * 16];
-    strcpy(cstr, str.c_str());
-    return cstr;
+DSViz::Output _exploreDebugger(bst& b, const char* request) {
+    static string buffer;
+    static std::unique_ptr<DSViz::Explorer> explorer;
+    if (!b.getRoot()) return DSViz::Output{"", 0};
+
+    // "view" starts over, the other requests reuse the nodes shown so far
+    if (!explorer || string(request) == "view") {
+        // the mock objects live in the explorer's scope and go with it
+        explorer.reset(new DSViz::Explorer());
+        DSViz::MockScope::Bind bind(explorer->mocks());
+        explorer->load_ds(mock::get(b.getRoot()));
+    }
+    return explorer->request(request, buffer);
 }
 #endif
 
@@ -14,13 +14,30 @@ def get_result(func):
     frame = mydebugger.GetSelectedTarget().GetProcess().GetSelectedThread().GetSelectedFrame()
     options = lldb.SBExpressionOptions()
     result = frame.EvaluateExpression(func, options)
-    cstring = mydebugger.GetSelectedTarget().GetProcess().ReadCStringFromMemory(result.GetValueAsUnsigned(), 1024 * 16, lldb.SBError())
-    return cstring
+    # func returns a DSViz::Output, read exactly its bytes in one go
+    data = result.GetChildMemberWithName('data').GetValueAsUnsigned()
+    size = result.GetChildMemberWithName('size').GetValueAsUnsigned()
+    if size == 0:
+        return ''
+    error = lldb.SBError()
+    raw = mydebugger.GetSelectedTarget().GetProcess().ReadMemory(data, size, error)
+    if not error.Success():
+        print(error)
+        return ''
+    return raw.decode('utf-8', 'replace')
 
 
 def plot():
     print("plot called")
-    data = get_result('_dotToDebugger(b)')
+    return show(get_result('_dotToDebugger(b)'))
+
+
+# request is "view", "expand <node> <depth>" or "page <node> <offset> <count>"
+def explore(request='view'):
+    return show(get_result('_exploreDebugger(b, "%s")' % request))
+
+
+def show(data):
     print(data)
     document = '''
 <html>
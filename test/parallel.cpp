@@ -0,0 +1,306 @@
+// Checks that ParallelWalker produces the same graph as a serial load_ds
+//
+//   make test
+#include "dsv.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define CHECK(cond)                                                            \
+    do {                                                                       \
+        if (!(cond)) {                                                         \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__,   \
+                    #cond);                                                    \
+            exit(1);                                                           \
+        }                                                                      \
+    } while (0)
+
+struct tree_node {
+    int        data;
+    tree_node *left, *right;
+};
+
+void dsviz_show(tree_node *P, DSViz::IViz &viz);
+typedef DSViz::Mock<tree_node, dsviz_show> mock;
+
+static std::atomic<size_t> shows(0);
+
+void
+dsviz_show(tree_node *P, DSViz::IViz &viz) {
+    ++shows;
+    DSViz::TableNode node(viz);
+    viz.setName(mock::get(P), node.name);
+    node.add("data", P->data);
+    if (P->left) node.addEdge(mock::get(P->left), "left");
+    if (P->right) node.addEdge(mock::get(P->right), "right");
+}
+
+// a binary search tree of the keys 0 .. n-1 inserted in a scrambled order
+static std::vector<tree_node>
+makeTree(int n) {
+    std::vector<tree_node> nodes(n);
+    for (int i = 0; i < n; ++i) {
+        nodes[i] = tree_node{(int)((i * 7919L) % n), nullptr, nullptr};
+        for (tree_node *at = &nodes[0]; i != 0;) {
+            tree_node *&next = nodes[i].data < at->data ? at->left : at->right;
+            if (next == nullptr) {
+                next = &nodes[i];
+                break;
+            }
+            at = next;
+        }
+    }
+    return nodes;
+}
+
+static std::string
+serial(tree_node *root) {
+    DSViz::MockScope scope;
+    DSViz::Dot       dot;
+    dot.load_ds(mock::get(root));
+    return dot.print();
+}
+
+static std::string
+parallel(tree_node *root, DSViz::ParallelOptions options) {
+    DSViz::MockScope scope;
+    DSViz::Dot       dot;
+    DSViz::ParallelWalker(dot, options).load_ds(mock::get(root));
+    return dot.print();
+}
+
+static void
+testMockScope() {
+    std::vector<tree_node> nodes = makeTree(5000);
+    std::string            want  = serial(&nodes[0]);
+
+    DSViz::ParallelOptions options;
+    options.threads = 8;
+    for (int run = 0; run < 20; ++run)
+        CHECK(parallel(&nodes[0], options) == want);
+
+    // without a scope the workers share the process-wide registry
+    DSViz::Dot dot;
+    DSViz::ParallelWalker(dot, options).load_ds(mock::get(&nodes[0]));
+    CHECK(dot.print() == want);
+}
+
+static size_t
+count(const std::string &s, const std::string &what) {
+    size_t n = 0;
+    for (size_t i = s.find(what); i != std::string::npos;
+         i        = s.find(what, i + 1))
+        ++n;
+    return n;
+}
+
+static void
+testBudget() {
+    std::vector<tree_node> nodes = makeTree(5000);
+    DSViz::Budget          budgets[2];
+    budgets[0].max_nodes = 50;
+    budgets[1].max_depth = 3;
+
+    for (auto &budget : budgets) {
+        std::string want;
+        {
+            DSViz::MockScope scope;
+            DSViz::Dot       dot;
+            dot.setBudget(budget);
+            dot.load_ds(mock::get(&nodes[0]));
+            want = dot.print();
+        }
+        size_t shown = count(want, "data");
+
+        for (bool deterministic : {true, false}) {
+            DSViz::ParallelOptions options;
+            options.threads       = 8;
+            options.deterministic = deterministic;
+            DSViz::MockScope scope;
+            DSViz::Dot       dot;
+            dot.setBudget(budget);
+            shows = 0;
+            DSViz::ParallelWalker(dot, options).load_ds(mock::get(&nodes[0]));
+            std::string got = dot.print();
+            CHECK(count(got, "data") == shown);
+            CHECK(got.find(" more") != std::string::npos);
+            if (deterministic) {
+                CHECK(got == want);
+                // the merge shows the nodes the workers left out
+                CHECK(shows <= 2 * shown);
+            } else
+                CHECK(shows == shown);
+        }
+    }
+}
+
+// draws an edge from `from`, which a serial walk names before this node
+struct ref_node : DSViz::IDataStructure {
+    std::string             label;
+    std::vector<ref_node *> kids;
+    ref_node               *from  = nullptr;
+    ref_node               *to    = nullptr; // an edge, but not loaded
+    int                     delay = 0;  // ms
+    std::string             style = ""; // of the edge from `from`
+
+    virtual void dsviz_show(DSViz::IViz &viz) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(delay));
+        DSViz::TableNode node(viz);
+        viz.setName(this, node.name);
+        node.add("label", label);
+        for (auto k : kids)
+            node.addEdge(k);
+        if (from) viz.addEdge(from, node.name, "[style=dotted" + style + "]");
+        if (to) viz.addEdge(node.name, (void *)to, "[style=dashed]");
+    }
+};
+
+static void
+testReferences() {
+    // a -> c -> e and a -> b -> d, and d refers to e; c is slow, so the
+    // task of d is created before the task of e
+    ref_node a, b, c, d, e;
+    a.label = "a", b.label = "b", c.label = "c", d.label = "d", e.label = "e";
+    a.kids  = {&c, &b};
+    c.kids  = {&e};
+    b.kids  = {&d};
+    c.delay = 100;
+    d.from  = &e;
+
+    DSViz::Dot serial;
+    serial.load_ds(&a);
+    std::string want = serial.print();
+
+    for (bool deterministic : {true, false}) {
+        DSViz::ParallelOptions options;
+        options.threads       = 4;
+        options.deterministic = deterministic;
+        DSViz::Dot dot;
+        DSViz::ParallelWalker(dot, options).load_ds(&a);
+        std::string got = dot.print();
+        CHECK(got.find('\x1f') == std::string::npos);
+        if (deterministic) CHECK(got == want);
+        std::string edge = dot.getName(&e) + " -> " + dot.getName(&d);
+        CHECK(got.find(edge) != std::string::npos);
+    }
+}
+
+// a chain of slow nodes stops being shown once the time limit has passed
+static void
+testDeadline() {
+    std::vector<ref_node> chain(40);
+    for (size_t i = 0; i < chain.size(); ++i) {
+        chain[i].label = std::to_string(i);
+        chain[i].delay = 10;
+        if (i + 1 < chain.size()) chain[i].kids = {&chain[i + 1]};
+    }
+    DSViz::Budget budget;
+    budget.time_limit = std::chrono::milliseconds(50);
+
+    for (bool deterministic : {true, false}) {
+        DSViz::ParallelOptions options;
+        options.threads       = 2;
+        options.deterministic = deterministic;
+        DSViz::Dot dot;
+        dot.setBudget(budget);
+        auto start = std::chrono::steady_clock::now();
+        DSViz::ParallelWalker(dot, options).load_ds(&chain[0]);
+        CHECK(std::chrono::steady_clock::now() - start <
+              std::chrono::milliseconds(200));
+        std::string got = dot.print();
+        CHECK(got.find(" more") != std::string::npos);
+        CHECK(!dot.hasNode(&chain.back()));
+    }
+}
+
+// an edge to a node which a later load_ds shows is not replaced by a stub
+static void
+testNamedLater() {
+    ref_node d, e;
+    d.label = "d", e.label = "e";
+    d.to    = &e;
+    DSViz::Budget budget;
+    budget.max_nodes = 10;
+
+    for (int parallel = 0; parallel < 2; ++parallel) {
+        DSViz::Dot dot;
+        dot.setBudget(budget);
+        if (parallel) {
+            DSViz::ParallelOptions options;
+            options.threads = 2;
+            DSViz::ParallelWalker(dot, options).load_ds(&d);
+            DSViz::ParallelWalker(dot, options).load_ds(&e);
+        } else {
+            dot.load_ds(&d);
+            dot.load_ds(&e);
+        }
+        std::string got = dot.print();
+        CHECK(got.find(" more") == std::string::npos);
+        std::string edge = dot.getName(&d) + " -> " + dot.getName(&e);
+        CHECK(got.find(edge) != std::string::npos);
+    }
+}
+
+// a long chain is shown as its first nodes and one node for the rest
+static void
+testChains() {
+    std::vector<ref_node> chain(1000);
+    for (size_t i = 0; i < chain.size(); ++i) {
+        chain[i].label = "n" + std::to_string(i);
+        if (i + 1 < chain.size()) chain[i].kids = {&chain[i + 1]};
+    }
+    chain[0].to = &chain[500];
+    DSViz::Summary summary;
+    summary.chain_ends = 3;
+
+    DSViz::Dot dot;
+    dot.setSummary(summary);
+    dot.load_ds(&chain[0]);
+    std::string got = dot.print();
+    CHECK(count(got, ">n") == 3);
+    CHECK(got.find("\xe2\x80\xa6 997 more") != std::string::npos);
+    CHECK(dot.getName(&chain[500]) == dot.getName(&chain[3]));
+    std::string edge = dot.getName(&chain[0]) + " -> " + dot.getName(&chain[3]);
+    CHECK(got.find(edge) != std::string::npos);
+}
+
+// text which looks like the placeholders of the workers
+static void
+testMarkers() {
+    ref_node a, b, c;
+    a.label = "\x1fN0.0\x1f";
+    b.label = "\x1fR1\x1f and \x1f";
+    c.label = "\x1f";
+    a.kids  = {&b, &c};
+    c.from  = &b;
+    c.style = ",label=\"\x1fN0.9\x1f" "E\x1f\"";
+
+    DSViz::Dot serial;
+    serial.load_ds(&a);
+    std::string want = serial.print();
+    CHECK(want.find("&#31;N0.0&#31;") != std::string::npos);
+
+    DSViz::ParallelOptions options;
+    options.threads = 2;
+    DSViz::Dot dot;
+    DSViz::ParallelWalker(dot, options).load_ds(&a);
+    CHECK(dot.print() == want);
+}
+
+int
+main() {
+    testMockScope();
+    testBudget();
+    testReferences();
+    testDeadline();
+    testNamedLater();
+    testChains();
+    testMarkers();
+    printf("ok\n");
+    return 0;
+}
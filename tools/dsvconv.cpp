@@ -0,0 +1,69 @@
+// Convert a capture written by DSViz::BinaryCapture into dot or JSON
+//
+//   dsvconv [--json | --stream] capture.dsvb > out.dot
+//
+// The dot output is what Dot::print would write. With --stream, nodes and
+// edges are written as they are read instead, in the order they were added
+// and without building subgraphs, so large captures need little memory.
+#include "dsv.hpp"
+
+#include <fcntl.h>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+int main(int argc, char **argv) {
+    bool        json = false, stream = false;
+    const char *path = nullptr;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--json") == 0)
+            json = true;
+        else if (strcmp(argv[i], "--stream") == 0)
+            stream = true;
+        else
+            path = argv[i];
+    }
+    if (path == nullptr) {
+        std::cerr << "usage: " << argv[0] << " [--json | --stream] capture"
+                  << std::endl;
+        return 2;
+    }
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror(path);
+        return 1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        std::cerr << path << ": empty capture" << std::endl;
+        return 1;
+    }
+    void *data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        perror(path);
+        return 1;
+    }
+
+    DSViz::BinaryLog log((const char *)data, st.st_size);
+    int              ret = 0;
+    if (json) {
+        std::string s = log.json();
+        if (s.empty()) ret = 1;
+        std::cout << s;
+    } else if (stream) {
+        DSViz::StreamingDot dot(std::cout, log.config());
+        if (!log.render(dot)) ret = 1;
+    } else {
+        DSViz::Dot dot(log.config());
+        if (log.render(dot))
+            std::cout << dot.print();
+        else
+            ret = 1;
+    }
+    munmap(data, st.st_size);
+    if (ret) std::cerr << path << ": malformed capture" << std::endl;
+    return ret;
+}